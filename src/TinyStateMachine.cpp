@@ -1,184 +1,731 @@
 #include "TinyStateMachine.h"
 #include <stdlib.h> // for malloc and free
 
-TinyStateMachine::TinyStateMachine() {
+const size_t GuardExpression::PASS;
+const size_t GuardExpression::FAIL;
 
-    // if max states is too high, set it to the correct largest number.
-    if (max_states >= TinyStateMachine::ANY_STATE) max_states = TinyStateMachine::ANY_STATE - 1;
+GuardExpression::GuardExpression() {
+    this->conditions = std::vector<GuardCondition>();
+}
+
+GuardExpression::GuardExpression(const GuardCondition &condition) {
+    this->conditions = std::vector<GuardCondition>(1, condition);
+    this->conditions[0].on_pass = PASS;
+    this->conditions[0].on_fail = FAIL;
+}
+
+GuardVariable::GuardVariable(const uint8_t *variable) {
+    this->variable = variable;
+    this->type = GUARD_UINT8;
+}
+
+GuardVariable::GuardVariable(const int *variable) {
+    this->variable = variable;
+    this->type = GUARD_INT;
+}
+
+GuardVariable::GuardVariable(const long *variable) {
+    this->variable = variable;
+    this->type = GUARD_LONG;
+}
+
+GuardVariable::GuardVariable(const unsigned long *variable) {
+    this->variable = variable;
+    this->type = GUARD_UNSIGNED_LONG;
+}
+
+GuardVariable::operator GuardExpression() const {
+    return *this != 0;
+}
+
+// append the comparisons of right to expression. Jumps within right move along with it.
+static void append(GuardExpression &expression, const GuardExpression &right) {
+    size_t offset = expression.conditions.size();
+    for (GuardCondition condition: right.conditions) {
+        if (condition.on_pass < GuardExpression::FAIL) condition.on_pass += offset;
+        if (condition.on_fail < GuardExpression::FAIL) condition.on_fail += offset;
+        expression.conditions.push_back(condition);
+    }
+}
+
+GuardExpression operator&&(const GuardExpression &left, const GuardExpression &right) {
+    // a guard that always passes doesn't change the result.
+    if (right.conditions.empty()) return left;
+
+    // wherever left would pass, check right instead.
+    GuardExpression expression = left;
+    for (auto &condition: expression.conditions) {
+        if (condition.on_pass == GuardExpression::PASS) condition.on_pass = left.conditions.size();
+    }
+    append(expression, right);
+    return expression;
+}
 
-    this->transition_funcs = std::vector<TransitionFunction>(max_transitions);
-    this->from_states = std::vector<state_t>(max_transitions);
-    this->to_states = std::vector<state_t>(max_transitions);
+GuardExpression operator||(const GuardExpression &left, const GuardExpression &right) {
+    // either side always passing makes the whole guard always pass.
+    if (left.conditions.empty() || right.conditions.empty()) return GuardExpression();
+
+    // wherever left would fail, check right instead.
+    GuardExpression expression = left;
+    for (auto &condition: expression.conditions) {
+        if (condition.on_fail == GuardExpression::FAIL) condition.on_fail = left.conditions.size();
+    }
+    append(expression, right);
+    return expression;
+}
+
+static GuardExpression compare(const GuardVariable &left, CompareOperator compare, long right) {
+    GuardValue constant;
+    switch (left.type) {
+        case GUARD_UINT8: constant.uint8_value = (uint8_t) right; break;
+        case GUARD_INT: constant.int_value = (int) right; break;
+        case GUARD_LONG: constant.long_value = right; break;
+        case GUARD_UNSIGNED_LONG: constant.unsigned_long_value = (unsigned long) right; break;
+    }
+    return GuardExpression({left.variable, nullptr, constant, left.type, compare, GuardExpression::PASS,
+                            GuardExpression::FAIL});
+}
+
+static GuardExpression compare(const GuardVariable &left, CompareOperator compare, const GuardVariable &right) {
+    // a null right variable would be taken for a comparison to the constant, and variables of different types can't be
+    // read the same way, so make those comparisons ones that add_transition() rejects instead.
+    bool valid = right.variable && right.type == left.type;
+    return GuardExpression({valid ? left.variable : nullptr, right.variable, GuardValue(), left.type, compare,
+                            GuardExpression::PASS, GuardExpression::FAIL});
+}
+
+GuardExpression operator==(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_EQ, right);
+}
+
+GuardExpression operator!=(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_NE, right);
+}
+
+GuardExpression operator<(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_LT, right);
+}
+
+GuardExpression operator<=(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_LE, right);
+}
+
+GuardExpression operator>(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_GT, right);
+}
+
+GuardExpression operator>=(const GuardVariable &left, long right) {
+    return compare(left, COMPARE_GE, right);
+}
+
+GuardExpression operator==(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_EQ, right);
+}
+
+GuardExpression operator!=(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_NE, right);
+}
+
+GuardExpression operator<(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_LT, right);
+}
+
+GuardExpression operator<=(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_LE, right);
+}
+
+GuardExpression operator>(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_GT, right);
+}
+
+GuardExpression operator>=(const GuardVariable &left, const GuardVariable &right) {
+    return compare(left, COMPARE_GE, right);
+}
+
+// check a comparison whose variables and constant have type T.
+template<typename T>
+static bool check_condition(const GuardCondition &condition, T constant) {
+    T left = *(const T *) condition.left;
+    T right = condition.right ? *(const T *) condition.right : constant;
+    switch (condition.compare) {
+        case COMPARE_EQ: return left == right;
+        case COMPARE_NE: return left != right;
+        case COMPARE_LT: return left < right;
+        case COMPARE_LE: return left <= right;
+        case COMPARE_GT: return left > right;
+        case COMPARE_GE: return left >= right;
+    }
+    return false;
+}
+
+template<typename state_type, typename transition_type>
+BasicTinyStateMachine<state_type, transition_type>::BasicTinyStateMachine() {
+    // no limits given, so grow the buffers as needed instead of reserving space for the largest possible machine.
+    this->max_states = ANY_STATE - 1;
+    this->max_transitions = MAX_TRANSITIONS;
+}
+
+template<typename state_type, typename transition_type>
+BasicTinyStateMachine<state_type, transition_type>::BasicTinyStateMachine(size_t max_states, size_t max_transitions) {
+
+    // if max states is too high, set it to the correct largest number.
+    if (max_states >= ANY_STATE) max_states = ANY_STATE - 1;
+    // num_transitions is a transition_t, so it can't count past MAX_TRANSITIONS.
+    if (max_transitions > MAX_TRANSITIONS) max_transitions = MAX_TRANSITIONS;
+    this->max_states = max_states;
+    this->max_transitions = max_transitions;
+
+    this->transition_funcs = std::vector<TransitionFunction>();
+    this->from_states = std::vector<state_t>();
+    this->to_states = std::vector<state_t>();
+    this->transition_funcs.reserve(max_transitions);
+    this->from_states.reserve(max_transitions);
+    this->to_states.reserve(max_transitions);
 
     this->num_states = 0;
     this->enter_funcs = std::vector<EnterFunction>();
     this->loop_funcs = std::vector<LoopFunction>();
     this->exit_funcs = std::vector<ExitFunction>();
 
-    this->num_child_state_machines = 0;
     this->child_state_machines = std::vector<ChildStateMachine>();
 }
 
-TinyStateMachine::~TinyStateMachine() {}
+template<typename state_type, typename transition_type>
+BasicTinyStateMachine<state_type, transition_type>::~BasicTinyStateMachine() {}
 
-bool TinyStateMachine::set_start_state(state_t start_state) {
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::set_start_state(state_t start_state) {
     if (start_state >= num_states) return false;
 
-    this->start_state = start_state;
+    region_start_states[state_regions[start_state]] = start_state;
     return true;
 }
 
-void TinyStateMachine::startup() {
-    // reset current state to the start state.
-    current_state = start_state;
-    // run the start func on the first state
-    if (every_state_enter_func)
-        every_state_enter_func();
-    if (enter_funcs[current_state])
-        enter_funcs[current_state]();
-
-    for (auto i = 0; i < max_child_state_machines; i++) {
-        if (child_state_machines[i].parent_state == current_state) {
-
-        }
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::startup() {
+    index_transitions();
+
+    // reset every region to its start state, and run the start func on it. Children always start fresh.
+    started = true;
+    for (state_t region = 0; region < num_regions; region++) {
+        state_t state = region_start_states[region];
+        current_states[region] = state;
+        if (state >= num_states) continue;
+
+        if (every_state_enter_func)
+            every_state_enter_func();
+        if (enter_funcs[state])
+            enter_funcs[state]();
+        if (state < child_state_machines.size() && child_state_machines[state].state_machine)
+            child_state_machines[state].state_machine->startup();
     }
 
-    startup_child_state_machines();
-
 }
 
-void TinyStateMachine::loop() {
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::loop() {
 
-    if (current_state >= num_states)
+    if (num_states == 0)
         return;
 
-    // run loop on the current state
+    if (!transitions_indexed)
+        index_transitions();
+
+    unsigned long loop_start = profiling && profiling_clock ? profiling_clock() : 0;
+
+    // run loop on the current state of every region
     loop_child_state_machines();
     if (every_state_loop_func)
         every_state_loop_func();
-    if (loop_funcs[current_state])
-        loop_funcs[current_state]();
-
-    // check if any transitions need to happen.
-    state_t to_state = current_state;
-    for (int i = 0; i < num_transitions; i++) {
-        // check if from state is the current state OR any state.
-        // If it is and the transition func succeeds, we need to transition.
-        // transition func will never be null do we don't have to check
-        if ((from_states[i] == current_state || from_states[i] == TinyStateMachine::ANY_STATE)
-            && transition_funcs[i]()) {
-            to_state = to_states[i];
-            break;
+    for (state_t region = 0; region < num_regions; region++) {
+        state_t state = current_states[region];
+        next_states[region] = NULL_STATE;
+        // a region that has stopped (e.g. no states) has nothing to loop or transition.
+        if (state >= num_states)
+            continue;
+
+        if (profiling)
+            state_loops[state]++;
+        if (loop_funcs[state])
+            loop_funcs[state]();
+    }
+
+    // check if any transitions need to happen. Only the transitions of the active states are checked, and each region
+    // stops at the first one whose guard passes. Guards see the states from before this loop().
+    for (state_t region = 0; region < num_regions; region++) {
+        state_t state = current_states[region];
+        if (state >= num_states)
+            continue;
+
+        for (size_t j = state_transition_starts[state]; j < state_transition_starts[state + 1]; j++) {
+            transition_t i = state_transitions[j];
+            if (profiling)
+                guard_evaluations[i]++;
+            // declarative guards have no transition func.
+            if (transition_funcs[i] ? transition_funcs[i]() : check_guard_conditions(i)) {
+                if (profiling)
+                    guard_passes[i]++;
+                next_states[region] = to_states[i];
+                break;
+            }
         }
     }
 
-    if (to_state == current_state) {
-        // none of the transition funcs succeeded, can exit loop() gracefully
-        return;
+    if (profiling && profiling_clock) {
+        unsigned long loop_time = profiling_clock() - loop_start;
+        for (state_t region = 0; region < num_regions; region++) {
+            if (current_states[region] < num_states) state_times[current_states[region]] += loop_time;
+        }
     }
 
-    // exit the current state, enter the next state, and set current state to next state
-    // need to do null checks for func pointers here.
-    if (every_state_exit_func) every_state_exit_func();
-    if (exit_funcs[current_state]) exit_funcs[current_state]();
-    current_state = to_state;
-    if (enter_funcs[current_state]) enter_funcs[current_state]();
-}
+    for (state_t region = 0; region < num_regions; region++) {
+        state_t current_state = current_states[region];
+        state_t to_state = next_states[region];
+        if (to_state == NULL_STATE || to_state == current_state) {
+            // none of the transition funcs of this region succeeded, nothing to do.
+            continue;
+        }
 
-state_t TinyStateMachine::add_state(EnterFunction enter_func, LoopFunction loop_func, ExitFunction exit_func) {
-    if (num_states >= max_states) return TinyStateMachine::NULL_STATE;
+        // exit the current state, enter the next state, and set current state to next state
+        exit_state(current_state);
+        current_states[region] = to_state;
+        if (to_state < num_states) enter_state(to_state, false);
+    }
+}
 
-    enter_funcs[num_states] = enter_func;
-    loop_funcs[num_states] = loop_func;
-    exit_funcs[num_states] = exit_func;
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state(EnterFunction enter_func, LoopFunction loop_func,
+                                                              ExitFunction exit_func) {
+    if (num_states >= max_states) return NULL_STATE;
+
+    enter_funcs.push_back(enter_func);
+    loop_funcs.push_back(loop_func);
+    exit_funcs.push_back(exit_func);
+    state_regions.push_back(num_regions - 1);
+    transitions_indexed = false;
+    if (profiling) {
+        state_loops.push_back(0);
+        state_times.push_back(0);
+    }
+    // the first state of a region is its start state.
+    if (region_start_states[num_regions - 1] == NULL_STATE)
+        region_start_states[num_regions - 1] = num_states;
     num_states++;
     // since we just incremented number of states, return states - 1 for the added state number.
     return num_states - 1;
 }
 
-state_t TinyStateMachine::add_state() {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state() {
     return this->add_state(nullptr, nullptr, nullptr);
 }
 
-state_t TinyStateMachine::add_state_enter(EnterFunction enter_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_enter(EnterFunction enter_func) {
     return this->add_state(enter_func, nullptr, nullptr);
 }
 
-state_t TinyStateMachine::add_state_loop(LoopFunction loop_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_loop(LoopFunction loop_func) {
     return this->add_state(nullptr, loop_func, nullptr);
 }
 
-state_t TinyStateMachine::add_state_exit(ExitFunction exit_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_exit(ExitFunction exit_func) {
     return this->add_state(nullptr, nullptr, exit_func);
 }
 
-state_t TinyStateMachine::add_state_ee(EnterFunction enter_func, ExitFunction exit_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_ee(EnterFunction enter_func, ExitFunction exit_func) {
     return this->add_state(enter_func, nullptr, exit_func);
 }
 
-state_t TinyStateMachine::add_state_el(EnterFunction enter_func, LoopFunction loop_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_el(EnterFunction enter_func, LoopFunction loop_func) {
     return this->add_state(enter_func, loop_func, nullptr);
 }
 
-state_t TinyStateMachine::add_state_le(LoopFunction loop_func, ExitFunction exit_func) {
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_state_le(LoopFunction loop_func, ExitFunction exit_func) {
     return this->add_state(nullptr, loop_func, exit_func);
 }
 
-bool TinyStateMachine::add_every_state_enter(EnterFunction enter_func) {
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_every_state_enter(EnterFunction enter_func) {
     this->every_state_enter_func = enter_func;
     return true;
 }
 
-bool TinyStateMachine::add_every_state_loop(LoopFunction loop_func) {
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_every_state_loop(LoopFunction loop_func) {
     this->every_state_loop_func = loop_func;
     return true;
 }
 
-bool TinyStateMachine::add_every_state_exit(ExitFunction exit_func) {
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_every_state_exit(ExitFunction exit_func) {
     this->every_state_exit_func = exit_func;
     return true;
 }
 
-bool TinyStateMachine::add_transition(state_t from_state, state_t to_state, TransitionFunction transition_func) {
-    if (num_transitions >= max_transitions) return false;
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::add_region() {
+    if (num_regions >= ANY_STATE) return NULL_STATE;
+
+    region_start_states.push_back(NULL_STATE);
+    current_states.push_back(NULL_STATE);
+    next_states.push_back(NULL_STATE);
+    transitions_indexed = false;
+    num_regions++;
+    return num_regions - 1;
+}
 
-    from_states[num_transitions] = from_state;
-    to_states[num_transitions] = to_state;
-    transition_funcs[num_transitions] = transition_func;
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_transition(state_t from_state, state_t to_state,
+                                                                        TransitionFunction transition_func) {
+    if (!can_add_transition(from_state, to_state)) return false;
+
+    from_states.push_back(from_state);
+    to_states.push_back(to_state);
+    transition_regions.push_back(get_transition_region(from_state, to_state));
+    if (profiling) {
+        guard_evaluations.push_back(0);
+        guard_passes.push_back(0);
+    }
+    transition_funcs.push_back(transition_func);
+    guard_starts.push_back(guard_conditions.size());
+    transitions_indexed = false;
     num_transitions++;
     return true;
 }
 
-bool TinyStateMachine::add_child_state_machine(state_t state, TinyStateMachine *child_state_machine) {
-    if (state >= max_states) {
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_transition(state_t from_state, state_t to_state,
+                                                                        const GuardExpression &guard) {
+    // check before compiling the guard, so a rejected transition leaves no comparisons behind.
+    if (!can_add_transition(from_state, to_state)) return false;
+    // loop() reads every variable of the guard, so they all need to exist.
+    for (auto &condition: guard.conditions) {
+        if (condition.left == nullptr) return false;
+    }
+
+    // jumps are relative to the start of the guard, so the comparisons can be copied as they are.
+    guard_conditions.insert(guard_conditions.end(), guard.conditions.begin(), guard.conditions.end());
+    return add_transition(from_state, to_state, TransitionFunction());
+}
+
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::add_child_state_machine(
+        state_t state, BasicTinyStateMachine *child_state_machine, HistoryType history) {
+    // children are stored by state, so only accept states that exist.
+    if (state >= num_states) {
         return false;
     }
 
-    if (num_child_state_machines >= max_child_state_machines) {
+    if (child_state_machine == nullptr || child_state_machine == this) {
         return false;
     }
 
-    child_state_machines[state] = {
-            .state_machine = child_state_machine,
-            .parent_state = state
-    };
+    if (state < child_state_machines.size() && child_state_machines[state].state_machine) {
+        return false;
+    }
 
-    num_child_state_machines++;
+    if (state >= child_state_machines.size())
+        child_state_machines.resize(state + 1, {nullptr, NO_HISTORY});
+    child_state_machines[state] = {child_state_machine, history};
     return true;
 }
 
-void TinyStateMachine::startup_child_state_machines() {
-    for (int i = 0; i < num_child_state_machines; i++) {
-        if (child_state_machines[i].parent_state == current_state) {
-            child_state_machines[i].state_machine->startup();
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::loop_child_state_machines() {
+    // only the children of active states run, so inactive children cost nothing.
+    for (state_t region = 0; region < num_regions; region++) {
+        state_t state = current_states[region];
+        if (state < child_state_machines.size() && child_state_machines[state].state_machine)
+            child_state_machines[state].state_machine->loop();
+    }
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::enter_state(state_t state, bool deep_history) {
+    // need to do null checks for func pointers here.
+    if (enter_funcs[state]) enter_funcs[state]();
+    enter_child_state_machine(state, deep_history);
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::exit_state(state_t state) {
+    // children exit before their parent state does.
+    if (state < child_state_machines.size() && child_state_machines[state].state_machine)
+        child_state_machines[state].state_machine->exit_active_states();
+    if (every_state_exit_func) every_state_exit_func();
+    if (exit_funcs[state]) exit_funcs[state]();
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::enter_child_state_machine(state_t state,
+                                                                                   bool deep_history) {
+    if (state >= child_state_machines.size() || !child_state_machines[state].state_machine) return;
+
+    ChildStateMachine &child = child_state_machines[state];
+    // deep history from further up overrides the child's own setting.
+    if (deep_history || child.history == DEEP_HISTORY) {
+        child.state_machine->resume(true);
+    } else if (child.history == SHALLOW_HISTORY) {
+        child.state_machine->resume(false);
+    } else {
+        child.state_machine->startup();
+    }
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::exit_active_states() {
+    for (state_t region = 0; region < num_regions; region++) {
+        if (current_states[region] < num_states) exit_state(current_states[region]);
+    }
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::resume(bool deep_history) {
+    // nothing to resume the first time around.
+    if (!started) {
+        startup();
+        return;
+    }
+
+    for (state_t region = 0; region < num_regions; region++) {
+        if (current_states[region] < num_states) enter_state(current_states[region], deep_history);
+    }
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::index_transitions() {
+    // transitions may have been added before the states they use, so find their regions now. Transitions between
+    // regions get NULL_STATE as their region, and are never taken.
+    std::vector<size_t> region_any_transitions(num_regions, 0);
+    state_transition_starts.assign(num_states + 1, 0);
+    for (transition_t i = 0; i < num_transitions; i++) {
+        state_t region = get_transition_region(from_states[i], to_states[i]);
+        transition_regions[i] = region;
+        if (region >= num_regions) continue;
+
+        if (from_states[i] == ANY_STATE) {
+            region_any_transitions[region]++;
+        } else if (from_states[i] < num_states) {
+            state_transition_starts[from_states[i] + 1]++;
+        }
+    }
+
+    // every state gets its own transitions and the ANY_STATE transitions of its region.
+    for (size_t state = 0; state < num_states; state++) {
+        state_transition_starts[state + 1] += state_transition_starts[state] +
+                                              region_any_transitions[state_regions[state]];
+    }
+
+    // fill in the transitions in the order they were added, so loop() checks them in that order.
+    std::vector<size_t> next_slots(state_transition_starts.begin(), state_transition_starts.end() - 1);
+    state_transitions.resize(state_transition_starts[num_states]);
+    for (transition_t i = 0; i < num_transitions; i++) {
+        state_t region = transition_regions[i];
+        if (region >= num_regions) continue;
+
+        if (from_states[i] == ANY_STATE) {
+            for (size_t state = 0; state < num_states; state++) {
+                if (state_regions[state] == region) state_transitions[next_slots[state]++] = i;
+            }
+        } else if (from_states[i] < num_states) {
+            state_transitions[next_slots[from_states[i]]++] = i;
         }
     }
+    transitions_indexed = true;
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::enable_profiling(ClockFunction clock) {
+    this->profiling_clock = clock;
+    if (!profiling) {
+        profiling = true;
+        guard_evaluations.resize(num_transitions, 0);
+        guard_passes.resize(num_transitions, 0);
+        state_loops.resize(num_states, 0);
+        state_times.resize(num_states, 0);
+    }
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::disable_profiling() {
+    profiling = false;
+}
+
+template<typename state_type, typename transition_type>
+void BasicTinyStateMachine<state_type, transition_type>::reset_profiling() {
+    guard_evaluations.assign(guard_evaluations.size(), 0);
+    guard_passes.assign(guard_passes.size(), 0);
+    state_loops.assign(state_loops.size(), 0);
+    state_times.assign(state_times.size(), 0);
+}
+
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::is_profiling() const {
+    return profiling;
+}
+
+template<typename state_type, typename transition_type>
+unsigned long BasicTinyStateMachine<state_type, transition_type>::get_guard_evaluations(transition_t transition) const {
+    if (transition >= guard_evaluations.size()) return 0;
+    return guard_evaluations[transition];
+}
+
+template<typename state_type, typename transition_type>
+unsigned long BasicTinyStateMachine<state_type, transition_type>::get_guard_passes(transition_t transition) const {
+    if (transition >= guard_passes.size()) return 0;
+    return guard_passes[transition];
+}
+
+template<typename state_type, typename transition_type>
+unsigned long BasicTinyStateMachine<state_type, transition_type>::get_state_loops(state_t state) const {
+    if (state >= state_loops.size()) return 0;
+    return state_loops[state];
+}
+
+template<typename state_type, typename transition_type>
+unsigned long BasicTinyStateMachine<state_type, transition_type>::get_state_time(state_t state) const {
+    if (state >= state_times.size()) return 0;
+    return state_times[state];
+}
+
+template<typename state_type, typename transition_type>
+const BasicTinyStateMachine<state_type, transition_type> *
+BasicTinyStateMachine<state_type, transition_type>::get_child_state_machine(state_t state) const {
+    if (state >= child_state_machines.size()) return nullptr;
+    return child_state_machines[state].state_machine;
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_current_state() const {
+    return current_states[0];
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_region_state(state_t region) const {
+    if (region >= num_regions) return NULL_STATE;
+    return current_states[region];
+}
+
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::in_state(state_t state) const {
+    return state < num_states && current_states[state_regions[state]] == state;
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_start_state() const {
+    return region_start_states[0];
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_region_start_state(state_t region) const {
+    if (region >= num_regions) return NULL_STATE;
+    return region_start_states[region];
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_state_region(state_t state) const {
+    if (state >= num_states) return NULL_STATE;
+    return state_regions[state];
+}
+
+template<typename state_type, typename transition_type>
+size_t BasicTinyStateMachine<state_type, transition_type>::get_num_regions() const {
+    return num_regions;
+}
+
+template<typename state_type, typename transition_type>
+size_t BasicTinyStateMachine<state_type, transition_type>::get_num_states() const {
+    return num_states;
+}
+
+template<typename state_type, typename transition_type>
+size_t BasicTinyStateMachine<state_type, transition_type>::get_num_transitions() const {
+    return num_transitions;
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_transition_from(transition_t transition) const {
+    if (transition >= num_transitions) return NULL_STATE;
+    return from_states[transition];
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_transition_to(transition_t transition) const {
+    if (transition >= num_transitions) return NULL_STATE;
+    return to_states[transition];
+}
+
+template<typename state_type, typename transition_type>
+typename BasicTinyStateMachine<state_type, transition_type>::state_t
+BasicTinyStateMachine<state_type, transition_type>::get_transition_region(state_t from_state, state_t to_state) const {
+    // transitions from ANY_STATE belong to the region they go to.
+    if (from_state < num_states && to_state < num_states && state_regions[from_state] != state_regions[to_state])
+        return NULL_STATE;
+    if (from_state < num_states) return state_regions[from_state];
+    if (to_state < num_states) return state_regions[to_state];
+    return 0;
 }
 
-void TinyStateMachine::loop_child_state_machines() {
-    for (int i = 0; i < num_child_state_machines; i++) {
-        if (child_state_machines[i].parent_state == current_state) {
-            child_state_machines[i].state_machine->loop();
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::can_add_transition(state_t from_state,
+                                                                            state_t to_state) const {
+    if (num_transitions >= max_transitions) return false;
+    // a transition can't move a region into a state of another region.
+    return get_transition_region(from_state, to_state) != NULL_STATE;
+}
+
+template<typename state_type, typename transition_type>
+bool BasicTinyStateMachine<state_type, transition_type>::check_guard_conditions(transition_t transition) const {
+    // an empty guard always passes. Otherwise, start at the first comparison and follow the jumps until one of them
+    // decides the guard. Jumps only go forward, so this always ends.
+    size_t start = guard_starts[transition];
+    if (start == guard_starts[transition + 1]) return true;
+
+    size_t next = 0;
+    while (next < GuardExpression::FAIL) {
+        const GuardCondition &condition = guard_conditions[start + next];
+        bool passes = false;
+        switch (condition.type) {
+            case GUARD_UINT8: passes = check_condition(condition, condition.constant.uint8_value); break;
+            case GUARD_INT: passes = check_condition(condition, condition.constant.int_value); break;
+            case GUARD_LONG: passes = check_condition(condition, condition.constant.long_value); break;
+            case GUARD_UNSIGNED_LONG:
+                passes = check_condition(condition, condition.constant.unsigned_long_value);
+                break;
         }
+        next = passes ? condition.on_pass : condition.on_fail;
     }
-}
\ No newline at end of file
+    return next == GuardExpression::PASS;
+}
+
+template class BasicTinyStateMachine<uint8_t, uint8_t>;
+template class BasicTinyStateMachine<uint8_t, uint16_t>;
+template class BasicTinyStateMachine<uint8_t, uint32_t>;
+template class BasicTinyStateMachine<uint16_t, uint8_t>;
+template class BasicTinyStateMachine<uint16_t, uint16_t>;
+template class BasicTinyStateMachine<uint16_t, uint32_t>;
+template class BasicTinyStateMachine<uint32_t, uint8_t>;
+template class BasicTinyStateMachine<uint32_t, uint16_t>;
+template class BasicTinyStateMachine<uint32_t, uint32_t>;
@@ -4,37 +4,192 @@
 #define TINYSTATEMACHINE_TINYSTATEMACHINE_H
 
 #include "functional"
+#include "vector"
+#include "stddef.h"
+#include "stdint.h"
+#include "type_traits"
 
-typedef unsigned char state_t;
-typedef unsigned char transition_t;
-
-class TinyStateMachine;
+// index types of the default, 8-bit TinyStateMachine.
+typedef uint8_t state_t;
+typedef uint8_t transition_t;
 
 typedef std::function<bool()> TransitionFunction;
 typedef std::function<void()> EnterFunction;
 typedef std::function<void()> LoopFunction;
 typedef std::function<void()> ExitFunction;
-
+typedef std::function<unsigned long()> ClockFunction;
+
+/**
+ * How a declarative guard compares its variable to a constant or another variable.
+ */
+typedef enum {
+    COMPARE_EQ, // ==
+    COMPARE_NE, // !=
+    COMPARE_LT, // <
+    COMPARE_LE, // <=
+    COMPARE_GT, // >
+    COMPARE_GE, // >=
+} CompareOperator;
+
+/**
+ * The type of the variables a declarative guard reads.
+ */
+typedef enum {
+    GUARD_UINT8,         // uint8_t, e.g. flags
+    GUARD_INT,           // int
+    GUARD_LONG,          // long
+    GUARD_UNSIGNED_LONG, // unsigned long, e.g. timestamps from millis()
+} GuardType;
+
+/**
+ * A constant in a declarative guard, stored as the type of the variable it is compared to.
+ */
+typedef union {
+    uint8_t uint8_value;
+    int int_value;
+    long long_value;
+    unsigned long unsigned_long_value;
+} GuardValue;
+
+/**
+ * A single comparison in a declarative guard: *left compared to *right, or to constant if right is null. Both
+ * variables and the constant have the same type. on_pass and on_fail say what comes next: the index of another
+ * comparison in the same guard, or GuardExpression::PASS or FAIL.
+ */
 typedef struct {
-    TinyStateMachine *state_machine;
-    state_t parent_state;
-} ChildStateMachine;
+    const void *left;
+    const void *right;
+    GuardValue constant;
+    GuardType type;
+    CompareOperator compare;
+    size_t on_pass;
+    size_t on_fail;
+} GuardCondition;
+
+/**
+ * A declarative guard: comparisons of registered variables, combined with && and ||. Stored as a list of comparisons
+ * that jump forward to the next one to check, so it keeps the shape of the expression and only grows by one entry per
+ * comparison. loop() checks it from a flat table of comparisons, without calling a function per guard.
+ * Build one from GuardVariable comparisons, e.g. GuardVariable(&counter) >= 10 && GuardVariable(&enabled).
+ */
+class GuardExpression {
+
+public:
+    static const size_t PASS = (size_t) -1; // the guard passes.
+    static const size_t FAIL = PASS - 1; // the guard fails.
+
+    std::vector<GuardCondition> conditions;
+
+    /**
+     * Constructor. A guard that always passes.
+     */
+    GuardExpression();
+
+    /**
+     * Constructor. A guard with a single comparison.
+     * @param condition the comparison. Its on_pass and on_fail are set to PASS and FAIL.
+     */
+    explicit GuardExpression(const GuardCondition &condition);
+
+};
+
+/**
+ * A variable that declarative guards can read: a uint8_t, int, long or unsigned long. The variable must outlive the
+ * state machine.
+ */
+class GuardVariable {
+
+public:
+    const void *variable;
+    GuardType type;
+
+    /**
+     * Constructor. One per supported type.
+     * @param variable the variable to read when the guard is checked. Guards that read a null variable are rejected by
+     * add_transition().
+     */
+    explicit GuardVariable(const uint8_t *variable);
 
-class TinyStateMachine {
+    explicit GuardVariable(const int *variable);
+
+    explicit GuardVariable(const long *variable);
+
+    explicit GuardVariable(const unsigned long *variable);
+
+    /**
+     * Use the variable as a guard on its own: passes if the variable is not 0.
+     */
+    operator GuardExpression() const;
+
+};
+
+GuardExpression operator&&(const GuardExpression &left, const GuardExpression &right);
+GuardExpression operator||(const GuardExpression &left, const GuardExpression &right);
+
+// constants are converted to the type of the variable they are compared to.
+GuardExpression operator==(const GuardVariable &left, long right);
+GuardExpression operator!=(const GuardVariable &left, long right);
+GuardExpression operator<(const GuardVariable &left, long right);
+GuardExpression operator<=(const GuardVariable &left, long right);
+GuardExpression operator>(const GuardVariable &left, long right);
+GuardExpression operator>=(const GuardVariable &left, long right);
+
+// both variables must have the same type. Comparisons of different types are rejected by add_transition().
+GuardExpression operator==(const GuardVariable &left, const GuardVariable &right);
+GuardExpression operator!=(const GuardVariable &left, const GuardVariable &right);
+GuardExpression operator<(const GuardVariable &left, const GuardVariable &right);
+GuardExpression operator<=(const GuardVariable &left, const GuardVariable &right);
+GuardExpression operator>(const GuardVariable &left, const GuardVariable &right);
+GuardExpression operator>=(const GuardVariable &left, const GuardVariable &right);
+
+/**
+ * What a child state machine does when its parent state is entered again.
+ */
+typedef enum {
+    NO_HISTORY,      // restart the child from its start state with startup().
+    SHALLOW_HISTORY, // resume the child in the states it was last in. Its own children follow their own history.
+    DEEP_HISTORY,    // resume the child, and all of its children, in the states they were last in.
+} HistoryType;
+
+/**
+ * A state machine with configurable index widths. state_type limits the number of states (two values are reserved for
+ * ANY_STATE and NULL_STATE), transition_type limits the number of transitions. The transition table stores one
+ * state_type per from and to state, so narrower types use less memory.
+ *
+ * Instantiated for every combination of uint8_t, uint16_t and uint32_t. Use TinyStateMachine for 8-bit machines, or
+ * SizedTinyStateMachine to pick the narrowest types for a given size.
+ */
+template<typename state_type, typename transition_type>
+class BasicTinyStateMachine {
+
+public:
+    typedef state_type state_t;
+    typedef transition_type transition_t;
 
 private:
+    typedef struct {
+        BasicTinyStateMachine *state_machine;
+        HistoryType history;
+    } ChildStateMachine;
+
     // state definitions
     std::vector<EnterFunction> enter_funcs;
-    std::vector<EnterFunction> loop_funcs;
-    std::vector<EnterFunction> exit_funcs;
-    std::vector<ChildStateMachine> child_state_machines; // each states can have a child state machine that runs inside that state.
+    std::vector<LoopFunction> loop_funcs;
+    std::vector<ExitFunction> exit_funcs;
+    // each state can have a child state machine that runs inside that state. Indexed by state, and only as long as
+    // the last state with a child, so looking up the child of an active state is cheap.
+    std::vector<ChildStateMachine> child_state_machines;
 
-    state_t current_state = 0;
     size_t num_states = 0;
     size_t max_states = 0;
-    state_t start_state = 0;
-    state_t max_child_state_machines = 0;
-    state_t num_child_state_machines = 0;
+    bool started = false;
+
+    // region definitions. Every state belongs to one region, and every region has one active state.
+    std::vector<state_t> state_regions; // the region of each state.
+    std::vector<state_t> region_start_states = std::vector<state_t>(1, NULL_STATE);
+    std::vector<state_t> current_states = std::vector<state_t>(1, NULL_STATE); // the active state of each region.
+    std::vector<state_t> next_states = std::vector<state_t>(1, NULL_STATE); // scratch space for loop().
+    state_t num_regions = 1;
 
     // every state definitions
     EnterFunction every_state_enter_func;
@@ -45,34 +200,77 @@ private:
     std::vector<TransitionFunction> transition_funcs;
     std::vector<state_t> from_states;
     std::vector<state_t> to_states;
+    std::vector<state_t> transition_regions; // the region each transition moves, so all regions share one table.
+    // declarative guards of every transition, back to back. Transition i uses guard_starts[i] to guard_starts[i + 1].
+    std::vector<GuardCondition> guard_conditions;
+    std::vector<size_t> guard_starts = std::vector<size_t>(1, 0);
     transition_t num_transitions = 0;
     size_t max_transitions = 0;
-
-    void startup_child_state_machines();
+    // the transitions each state can take, in the order they were added, with the ANY_STATE transitions of its region
+    // merged in. State i uses state_transitions[state_transition_starts[i]] to [state_transition_starts[i + 1]].
+    // Built by startup(), and again by loop() if states or transitions were added since.
+    std::vector<transition_t> state_transitions;
+    std::vector<size_t> state_transition_starts;
+    bool transitions_indexed = false;
+
+    // profiling counters, only allocated and updated once enable_profiling() is called.
+    bool profiling = false;
+    ClockFunction profiling_clock;
+    std::vector<unsigned long> guard_evaluations; // per transition
+    std::vector<unsigned long> guard_passes; // per transition
+    std::vector<unsigned long> state_loops; // per state
+    std::vector<unsigned long> state_times; // per state
 
     void loop_child_state_machines();
 
+    void enter_state(state_t state, bool deep_history);
+
+    void exit_state(state_t state);
+
+    void enter_child_state_machine(state_t state, bool deep_history);
+
+    void exit_active_states();
+
+    void resume(bool deep_history);
+
+    void index_transitions();
+
+    state_t get_transition_region(state_t from_state, state_t to_state) const;
+
+    bool can_add_transition(state_t from_state, state_t to_state) const;
+
+    bool check_guard_conditions(transition_t transition) const;
+
 public:
-    static const state_t NULL_STATE = 0xFF; // largest possible state
+    static const state_t NULL_STATE = (state_t) -1; // largest possible state
     static const state_t ANY_STATE = NULL_STATE - 1;
+    static const transition_t MAX_TRANSITIONS = (transition_t) -1; // largest possible number of transitions
 
 
+    /**
+     * Constructor. Creates a state machine that can hold up to ANY_STATE - 1 states and MAX_TRANSITIONS transitions.
+     * Buffers grow as states and transitions are added.
+     */
+    BasicTinyStateMachine();
+
     /**
      * Constructor. Allocates buffers to store all of the information required for the state machine.
      * User must define the maximum size of the state machine in terms of both states and transitions in the graph.
      * NOTE: if max_states must be at most ANY_STATE - 1, or will be set to this number otherwise.
+     * @param max_states the maximum number of states in the graph.
+     * @param max_transitions the maximum number of transitions in the graph.
      */
-    TinyStateMachine();
+    BasicTinyStateMachine(size_t max_states, size_t max_transitions);
 
     /**
      * Destructor. Deallocates all memory allocated during the creation of the state machine.
      */
-    ~TinyStateMachine();
+    ~BasicTinyStateMachine();
 
     /**
      *
-     * @param start_state the state to start the state machine with. Should not be called after startup() or loop(), or
-     * can lead to undefined behavior.
+     * @param start_state the state to start the state machine (or the region start_state is in) with. Should not be
+     * called after startup() or loop(), or can lead to undefined behavior.
      * @return true if the start state was set successfully, false otherwise (e.g. out of bounds).
      */
     bool set_start_state(state_t start_state);
@@ -148,16 +346,43 @@ public:
     state_t add_state_ee(EnterFunction enter_func, ExitFunction exit_func);
 
 
+    /**
+     * Add an orthogonal region to the state machine. Every state added after this call belongs to the new region, until
+     * add_region() is called again; the first of them is the region's start state. Regions are active at the same
+     * time, each in one of its own states, and share a single loop() and transition table. Regions are numbered from 0,
+     * which holds the states added before the first call to add_region(). Transitions never cross regions; use
+     * in_state() in a guard to react to another region.
+     * @return the added region if it can be added. \TinyStateMachine::NULL_STATE otherwise.
+     */
+    state_t add_region();
+
     /**
      * Add a transition to the state machine. The transition is defined by the from and to states, as well
      * as a func pointer that should return true if the transition should succeed.
+     * The transition moves the region its states belong to. Transitions from ANY_STATE apply to every state in the
+     * region of to_state. from_state and to_state must be in the same region: transitions between regions are rejected
+     * here if both states exist, or ignored by loop() if they are only found to cross regions at startup().
+     * In each loop(), at most one transition per region goes through. Guards see the states from before that loop(),
+     * so they can check other regions with in_state().
      * @param from_state the state to transition from.
      * @param to_state the state to transition to.
      * @param transition_func the transition func definition. Should return true if the transition should go through, false otherwise.
-     * @return true if able to add transition successfully, false otherwise (e.g. too many transitions).
+     * @return true if able to add transition successfully, false otherwise (e.g. too many transitions, or the states
+     * are in different regions).
      */
     bool add_transition(state_t from_state, state_t to_state, TransitionFunction transition_func);
 
+    /**
+     * Add a transition with a declarative guard, e.g. GuardVariable(&counter) >= 10. Behaves like a transition with a
+     * transition func, but the guard is checked from a table of comparisons instead of calling a function.
+     * @param from_state the state to transition from.
+     * @param to_state the state to transition to.
+     * @param guard the comparisons that decide whether the transition goes through.
+     * @return true if able to add transition successfully, false otherwise (e.g. too many transitions, the states
+     * are in different regions, or the guard reads a null variable or compares variables of different types).
+     */
+    bool add_transition(state_t from_state, state_t to_state, const GuardExpression &guard);
+
 
     /**
      * Add a function that runs when every single state is entered. Only the last function added will be executed.
@@ -183,9 +408,16 @@ public:
     bool add_every_state_exit(ExitFunction exit_func);
 
     /**
-     * Add an child state machine to a specific state. This state machine will be reset
+     * Add a child state machine to a specific state. The child runs while the state is active: it is entered after the
+     * state is entered, looped before the state is looped, and exited before the state is exited.
+     * @param state the parent state. Must already be added. Each state can have at most one child state machine.
+     * @param child_state_machine the child state machine. Should be fully set up, but not started.
+     * @param history what the child does when the state is entered again: restart (NO_HISTORY), or resume where it
+     * left off (SHALLOW_HISTORY or DEEP_HISTORY) without running startup() again.
+     * @return true if the child was added, false otherwise (e.g. the state doesn't exist or already has a child).
      */
-    bool add_child_state_machine(state_t state, TinyStateMachine *child_state_machine);
+    bool add_child_state_machine(state_t state, BasicTinyStateMachine *child_state_machine,
+                                 HistoryType history = NO_HISTORY);
 
 
     /**
@@ -198,7 +430,153 @@ public:
      */
     void loop();
 
+    /**
+     * Start counting how often each guard is checked and passes, and how many loops and how much time each state takes.
+     * Counting makes loop() slightly slower, so it is off by default.
+     * @param clock returns the current time, e.g. micros. Time is measured around the loop funcs, child state machines
+     * and guards of each loop(), and added to every state that was active. If null, time is not measured.
+     */
+    void enable_profiling(ClockFunction clock = nullptr);
+
+    /**
+     * Stop counting. The counters keep their values.
+     */
+    void disable_profiling();
+
+    /**
+     * Set every counter back to 0.
+     */
+    void reset_profiling();
+
+    /**
+     * @return true if counters are being updated, false otherwise.
+     */
+    bool is_profiling() const;
+
+    /**
+     * @param transition the index of the transition.
+     * @return how often the guard of the transition was checked while profiling.
+     */
+    unsigned long get_guard_evaluations(transition_t transition) const;
+
+    /**
+     * @param transition the index of the transition.
+     * @return how often the guard of the transition passed while profiling, i.e. how often the transition fired.
+     */
+    unsigned long get_guard_passes(transition_t transition) const;
+
+    /**
+     * @param state the state to check.
+     * @return how many loops the state was active for while profiling.
+     */
+    unsigned long get_state_loops(state_t state) const;
+
+    /**
+     * @param state the state to check.
+     * @return the time spent in loop() while the state was active and profiling, in the units of the clock.
+     */
+    unsigned long get_state_time(state_t state) const;
+
+    /**
+     * @param state the parent state.
+     * @return the child state machine of the state, nullptr if it has none.
+     */
+    const BasicTinyStateMachine *get_child_state_machine(state_t state) const;
+
+    /**
+     * @return the state the state machine (or its first region) is currently in.
+     */
+    state_t get_current_state() const;
+
+    /**
+     * @param region the region to check.
+     * @return the state the region is currently in. NULL_STATE if the region doesn't exist.
+     */
+    state_t get_region_state(state_t region) const;
+
+    /**
+     * Check whether a state is active. Useful for guards that depend on another region.
+     * @param state the state to check.
+     * @return true if state is the active state of its region, false otherwise.
+     */
+    bool in_state(state_t state) const;
+
+    /**
+     * @return the state the state machine (or its first region) starts in.
+     */
+    state_t get_start_state() const;
+
+    /**
+     * @param region the region to check.
+     * @return the state the region starts in. NULL_STATE if the region doesn't exist or has no states.
+     */
+    state_t get_region_start_state(state_t region) const;
+
+    /**
+     * @param state the state to check.
+     * @return the region the state belongs to. NULL_STATE if the state doesn't exist.
+     */
+    state_t get_state_region(state_t state) const;
+
+    /**
+     * @return the number of regions in the state machine. Always at least 1.
+     */
+    size_t get_num_regions() const;
+
+    /**
+     * @return the number of states added to the state machine.
+     */
+    size_t get_num_states() const;
+
+    /**
+     * @return the number of transitions added to the state machine.
+     */
+    size_t get_num_transitions() const;
+
+    /**
+     * @param transition the index of the transition, in the order it was added.
+     * @return the state the transition goes from. May be ANY_STATE. NULL_STATE if the transition doesn't exist.
+     */
+    state_t get_transition_from(transition_t transition) const;
+
+    /**
+     * @param transition the index of the transition, in the order it was added.
+     * @return the state the transition goes to. NULL_STATE if the transition doesn't exist.
+     */
+    state_t get_transition_to(transition_t transition) const;
+
 };
 
+template<typename state_type, typename transition_type>
+const state_type BasicTinyStateMachine<state_type, transition_type>::NULL_STATE;
+
+template<typename state_type, typename transition_type>
+const state_type BasicTinyStateMachine<state_type, transition_type>::ANY_STATE;
+
+template<typename state_type, typename transition_type>
+const transition_type BasicTinyStateMachine<state_type, transition_type>::MAX_TRANSITIONS;
+
+/**
+ * The original 8-bit state machine: up to 253 states and 255 transitions.
+ */
+typedef BasicTinyStateMachine<state_t, transition_t> TinyStateMachine;
+
+/**
+ * The narrowest of uint8_t, uint16_t and uint32_t that can hold max_value.
+ */
+template<size_t max_value>
+struct TinyStateMachineIndex {
+    typedef typename std::conditional<max_value <= UINT8_MAX, uint8_t,
+            typename std::conditional<max_value <= UINT16_MAX, uint16_t, uint32_t>::type>::type type;
+};
+
+/**
+ * A state machine using the narrowest index types that fit max_states states and max_transitions transitions.
+ * e.g. SizedTinyStateMachine<2000, 5000> uses 16-bit states and transitions.
+ */
+template<size_t max_states, size_t max_transitions>
+using SizedTinyStateMachine = BasicTinyStateMachine<typename TinyStateMachineIndex<max_states + 2>::type,
+        typename TinyStateMachineIndex<max_transitions>::type>;
+
 
 #endif //TINYSTATEMACHINE_TINYSTATEMACHINE_H
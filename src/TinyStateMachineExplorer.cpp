@@ -0,0 +1,377 @@
+#ifndef ARDUINO
+
+#include "TinyStateMachineExplorer.h"
+#include "algorithm"
+#include "atomic"
+#include "condition_variable"
+#include "functional"
+#include "mutex"
+#include "random"
+#include "thread"
+#include "unordered_set"
+
+// number of independently locked pieces of the visited set. Must be a power of 2.
+#define VISITED_SHARDS 64
+// number of frontier entries or walks a worker claims at a time.
+#define WORK_CHUNK 64
+
+typedef std::function<void(unsigned int, size_t)> WorkFunction;
+
+/**
+ * Worker threads that live for one explore() or explore_random() call, so a breadth first search doesn't start new
+ * threads for every depth. Threads are only started once there is more than one chunk of work to share.
+ */
+class WorkerPool {
+
+private:
+    unsigned int num_workers;
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable batch_ready;
+    std::condition_variable batch_done;
+    unsigned long batch = 0;
+    unsigned int busy_workers = 0;
+    bool stopping = false;
+
+    const WorkFunction *work = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next_index;
+
+    void work_batch(unsigned int worker) {
+        while (true) {
+            size_t begin = next_index.fetch_add(WORK_CHUNK);
+            if (begin >= count) return;
+            size_t end = std::min(begin + WORK_CHUNK, count);
+            for (size_t i = begin; i < end; i++) (*work)(worker, i);
+        }
+    }
+
+    void worker_loop(unsigned int worker) {
+        unsigned long done_batch = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                batch_ready.wait(guard, [this, done_batch] { return stopping || batch != done_batch; });
+                if (stopping) return;
+                done_batch = batch;
+            }
+
+            work_batch(worker);
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy_workers == 0) batch_done.notify_one();
+        }
+    }
+
+public:
+    explicit WorkerPool(unsigned int num_workers) : num_workers(num_workers), next_index(0) {}
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        batch_ready.notify_all();
+        for (auto &thread: threads) thread.join();
+    }
+
+    /**
+     * Call work(worker, i) for every i below count, spread over the workers, and wait for all of them to finish.
+     * The calling thread is worker 0.
+     */
+    void run(size_t count, const WorkFunction &work) {
+        this->work = &work;
+        this->count = count;
+        next_index = 0;
+
+        // a single chunk isn't worth waking up the other workers for.
+        if (num_workers <= 1 || count <= WORK_CHUNK) {
+            work_batch(0);
+            return;
+        }
+
+        if (threads.empty()) {
+            for (unsigned int worker = 1; worker < num_workers; worker++)
+                threads.emplace_back(&WorkerPool::worker_loop, this, worker);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy_workers = threads.size();
+            batch++;
+        }
+        batch_ready.notify_all();
+        work_batch(0);
+
+        std::unique_lock<std::mutex> guard(lock);
+        batch_done.wait(guard, [this] { return busy_workers == 0; });
+    }
+
+};
+
+typedef struct {
+    std::vector<unsigned long> state_visits;
+    std::vector<unsigned long> transition_fires;
+    std::vector<uint64_t> next_frontier;
+    size_t num_stuck_walks;
+} WorkerResult;
+
+typedef struct {
+    std::mutex lock;
+    std::unordered_set<uint64_t> keys;
+} VisitedShard;
+
+TinyStateMachineExplorer::TinyStateMachineExplorer(const TinyStateMachine *state_machine) {
+    this->state_machine = state_machine;
+    this->num_threads = 0;
+    this->candidates = std::vector<std::vector<transition_t>>();
+}
+
+void TinyStateMachineExplorer::set_num_threads(unsigned int num_threads) {
+    this->num_threads = num_threads;
+}
+
+ExplorationReport TinyStateMachineExplorer::explore(size_t max_depth, size_t history_length) {
+    build_candidates();
+    ExplorationReport report = new_report();
+    size_t num_states = state_machine->get_num_states();
+    if (start_states.empty()) {
+        find_stuck_states(report);
+        return report;
+    }
+
+    // a sequence is packed into a key with the current state in the lowest byte and older states above it. History a
+    // sequence doesn't have yet is NULL_STATE, since 0 is a real state: a start state s must not look like 0 -> s.
+    if (history_length > MAX_HISTORY_LENGTH) history_length = MAX_HISTORY_LENGTH;
+    uint64_t key_mask = history_length == MAX_HISTORY_LENGTH
+                        ? ~(uint64_t) 0
+                        : ((uint64_t) 1 << (8 * (history_length + 1))) - 1;
+    auto start_key = [key_mask](state_t start_state) {
+        return (~(uint64_t) 0 << 8 | start_state) & key_mask;
+    };
+
+    std::vector<VisitedShard> visited(VISITED_SHARDS);
+    auto visit = [&visited](uint64_t key) {
+        VisitedShard &shard = visited[(key * 0x9E3779B97F4A7C15ull) >> 58 & (VISITED_SHARDS - 1)];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        return shard.keys.insert(key).second;
+    };
+
+    std::vector<uint64_t> frontier;
+    for (state_t start_state: start_states) {
+        frontier.push_back(start_key(start_state));
+        visit(frontier.back());
+        report.state_visits[start_state]++;
+    }
+    report.num_sequences = frontier.size();
+
+    unsigned int workers = get_num_workers();
+    std::vector<WorkerResult> results(workers);
+    WorkerPool pool(workers);
+
+    for (size_t depth = 0; depth < max_depth && !frontier.empty(); depth++) {
+        for (auto &result: results) {
+            result.state_visits.assign(num_states, 0);
+            result.transition_fires.assign(report.transition_fires.size(), 0);
+            result.next_frontier.clear();
+        }
+
+        pool.run(frontier.size(), [&](unsigned int worker, size_t index) {
+            WorkerResult &result = results[worker];
+            uint64_t key = frontier[index];
+            state_t state = key & 0xFF;
+
+            for (transition_t transition: candidates[state]) {
+                state_t to_state = state_machine->get_transition_to(transition);
+                result.transition_fires[transition]++;
+                // a transition back to the same state is taken, but doesn't make a new sequence.
+                if (to_state == state) continue;
+
+                uint64_t next_key = ((key << 8) | to_state) & key_mask;
+                if (visit(next_key)) {
+                    result.state_visits[to_state]++;
+                    result.next_frontier.push_back(next_key);
+                }
+            }
+        });
+
+        frontier.clear();
+        for (auto &result: results) {
+            for (size_t i = 0; i < num_states; i++) report.state_visits[i] += result.state_visits[i];
+            for (size_t i = 0; i < report.transition_fires.size(); i++)
+                report.transition_fires[i] += result.transition_fires[i];
+            frontier.insert(frontier.end(), result.next_frontier.begin(), result.next_frontier.end());
+        }
+        report.num_sequences += frontier.size();
+    }
+
+    report.complete = frontier.empty();
+    find_stuck_states(report);
+    return report;
+}
+
+ExplorationReport TinyStateMachineExplorer::explore_random(size_t num_walks, size_t walk_length,
+                                                           double guard_probability, unsigned long seed) {
+    build_candidates();
+    ExplorationReport report = new_report();
+    size_t num_states = state_machine->get_num_states();
+    if (start_states.empty()) {
+        find_stuck_states(report);
+        return report;
+    }
+
+    unsigned int workers = get_num_workers();
+    std::vector<WorkerResult> results(workers);
+    for (auto &result: results) {
+        result.state_visits.assign(num_states, 0);
+        result.transition_fires.assign(report.transition_fires.size(), 0);
+        result.num_stuck_walks = 0;
+    }
+
+    // a walk is stuck in a state if none of its transitions leave it, whichever guards pass.
+    std::vector<bool> can_leave(num_states, false);
+    for (size_t state = 0; state < num_states; state++) {
+        for (transition_t transition: candidates[state]) {
+            if (state_machine->get_transition_to(transition) != state) can_leave[state] = true;
+        }
+    }
+
+    WorkerPool pool(workers);
+    pool.run(num_walks, [&](unsigned int worker, size_t walk) {
+        WorkerResult &result = results[worker];
+        // seed per walk rather than per worker, so the results don't depend on how walks are split up.
+        std::mt19937_64 random(seed + walk);
+        std::bernoulli_distribution guard(guard_probability);
+        state_t state = start_states[walk % start_states.size()];
+
+        for (size_t step = 0; step < walk_length; step++) {
+            result.state_visits[state]++;
+            if (!can_leave[state]) {
+                result.num_stuck_walks++;
+                break;
+            }
+
+            for (transition_t transition: candidates[state]) {
+                if (!guard(random)) continue;
+
+                // same as loop(): the first passing guard wins, even if it goes back to the same state.
+                result.transition_fires[transition]++;
+                state = state_machine->get_transition_to(transition);
+                break;
+            }
+        }
+    });
+
+    for (auto &result: results) {
+        for (size_t i = 0; i < num_states; i++) report.state_visits[i] += result.state_visits[i];
+        for (size_t i = 0; i < report.transition_fires.size(); i++)
+            report.transition_fires[i] += result.transition_fires[i];
+        report.num_stuck_walks += result.num_stuck_walks;
+    }
+    report.num_sequences = num_walks;
+
+    find_stuck_states(report);
+    return report;
+}
+
+void TinyStateMachineExplorer::build_candidates() {
+    size_t num_states = state_machine->get_num_states();
+    size_t num_transitions = state_machine->get_num_transitions();
+
+    start_states.clear();
+    for (size_t region = 0; region < state_machine->get_num_regions(); region++) {
+        state_t start_state = state_machine->get_region_start_state(region);
+        if (start_state < num_states) start_states.push_back(start_state);
+    }
+
+    candidates.assign(num_states, std::vector<transition_t>());
+    for (size_t i = 0; i < num_transitions; i++) {
+        state_t from_state = state_machine->get_transition_from(i);
+        state_t to_state = state_machine->get_transition_to(i);
+        // transitions to states that don't exist would stop the state machine; they can't be explored.
+        if (to_state >= num_states) continue;
+
+        if (from_state == TinyStateMachine::ANY_STATE) {
+            // transitions from ANY_STATE only apply to the region they go to.
+            state_t region = state_machine->get_state_region(to_state);
+            for (size_t state = 0; state < num_states; state++) {
+                if (state_machine->get_state_region(state) == region) candidates[state].push_back(i);
+            }
+        } else if (from_state < num_states) {
+            candidates[from_state].push_back(i);
+        }
+    }
+}
+
+void TinyStateMachineExplorer::find_stuck_states(ExplorationReport &report) const {
+    size_t num_states = state_machine->get_num_states();
+
+    // reachable from a start state, and able to reach a start state, through any transition. Regions never share
+    // transitions, so the only start state a state can reach is the one of its own region.
+    std::vector<bool> reachable(num_states, false);
+    std::vector<bool> returns(num_states, false);
+    std::vector<std::vector<state_t>> reverse_edges(num_states);
+    std::vector<state_t> stack(start_states);
+    for (state_t start_state: start_states) reachable[start_state] = true;
+
+    for (size_t state = 0; state < num_states; state++) {
+        for (transition_t transition: candidates[state]) {
+            reverse_edges[state_machine->get_transition_to(transition)].push_back(state);
+        }
+    }
+
+    while (!stack.empty()) {
+        state_t state = stack.back();
+        stack.pop_back();
+        for (transition_t transition: candidates[state]) {
+            state_t to_state = state_machine->get_transition_to(transition);
+            if (!reachable[to_state]) {
+                reachable[to_state] = true;
+                stack.push_back(to_state);
+            }
+        }
+    }
+
+    stack = start_states;
+    for (state_t start_state: start_states) returns[start_state] = true;
+    while (!stack.empty()) {
+        state_t state = stack.back();
+        stack.pop_back();
+        for (state_t from_state: reverse_edges[state]) {
+            if (!returns[from_state]) {
+                returns[from_state] = true;
+                stack.push_back(from_state);
+            }
+        }
+    }
+
+    for (size_t state = 0; state < num_states; state++) {
+        if (report.state_visits[state] == 0) report.unvisited_states.push_back(state);
+        if (!reachable[state]) continue;
+
+        bool can_leave = false;
+        for (transition_t transition: candidates[state]) {
+            if (state_machine->get_transition_to(transition) != state) can_leave = true;
+        }
+        if (!can_leave) report.dead_end_states.push_back(state);
+        if (!returns[state]) report.trap_states.push_back(state);
+    }
+}
+
+unsigned int TinyStateMachineExplorer::get_num_workers() const {
+    if (num_threads) return num_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ExplorationReport TinyStateMachineExplorer::new_report() const {
+    ExplorationReport report;
+    report.state_visits.assign(state_machine->get_num_states(), 0);
+    report.transition_fires.assign(state_machine->get_num_transitions(), 0);
+    report.num_sequences = 0;
+    report.num_stuck_walks = 0;
+    report.complete = false;
+    return report;
+}
+
+#endif //ARDUINO
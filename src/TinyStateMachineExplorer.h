@@ -0,0 +1,96 @@
+#pragma once
+
+#ifndef TINYSTATEMACHINE_TINYSTATEMACHINEEXPLORER_H
+#define TINYSTATEMACHINE_TINYSTATEMACHINEEXPLORER_H
+
+// host-side only: the explorer uses threads and is meant to run on a PC, not a microcontroller.
+#ifndef ARDUINO
+
+#include "TinyStateMachine.h"
+#include "stdint.h"
+#include "vector"
+
+typedef struct {
+    std::vector<unsigned long> state_visits;     // per state: sequences ending in the state (enumerated) or loops spent in it (random).
+    std::vector<unsigned long> transition_fires; // per transition: how often it was taken.
+    std::vector<state_t> unvisited_states;       // states never reached during exploration.
+    std::vector<state_t> dead_end_states;        // reachable states that no transition leads out of.
+    std::vector<state_t> trap_states;            // reachable states from which their region's start state is unreachable.
+    size_t num_sequences;                        // distinct state sequences (enumerated) or walks (random) explored.
+    size_t num_stuck_walks;                      // random walks that ended in a dead end state.
+    bool complete;                               // true if every reachable sequence was explored within max_depth.
+} ExplorationReport;
+
+/**
+ * Host-side explorer for the graph of a TinyStateMachine. Guards are never called: every guard is treated as a choice,
+ * either enumerated (every transition that could fire does) or random (each guard passes with a given probability,
+ * checked in the same order as loop() does). Exploration is split across all cores.
+ *
+ * Every region is explored from its own start state. Since guards are choices, regions are independent of each other.
+ *
+ * Child state machines are not explored; explore them with their own explorer.
+ */
+class TinyStateMachineExplorer {
+
+private:
+    const TinyStateMachine *state_machine;
+    unsigned int num_threads;
+
+    // for every state, the transitions that can fire from it, in the order loop() checks them.
+    std::vector<std::vector<transition_t>> candidates;
+    // the start state of every region that has states.
+    std::vector<state_t> start_states;
+
+    void build_candidates();
+
+    void find_stuck_states(ExplorationReport &report) const;
+
+    unsigned int get_num_workers() const;
+
+    ExplorationReport new_report() const;
+
+public:
+    /**
+     * The longest history that explore() can track. States are packed a byte each, with the current state, into 64 bits.
+     */
+    static const size_t MAX_HISTORY_LENGTH = 7;
+
+    /**
+     * Constructor. The state machine should be fully set up; it is only read, never run.
+     * @param state_machine the state machine to explore.
+     */
+    explicit TinyStateMachineExplorer(const TinyStateMachine *state_machine);
+
+    /**
+     * Set the number of worker threads. Defaults to the number of cores.
+     * @param num_threads the number of threads to use. 0 means the number of cores.
+     */
+    void set_num_threads(unsigned int num_threads);
+
+    /**
+     * Enumerate every state sequence reachable from the start states, breadth first. Two sequences are considered the same
+     * if they end in the same state with the same last history_length states before it.
+     * @param max_depth the maximum number of transitions in a sequence.
+     * @param history_length how many previous states distinguish sequences, at most MAX_HISTORY_LENGTH. With 0, this
+     * is plain reachability.
+     * @return coverage of every state and transition, as well as the stuck states found.
+     */
+    ExplorationReport explore(size_t max_depth, size_t history_length = 0);
+
+    /**
+     * Monte-Carlo exploration. Runs num_walks independent walks of walk_length loops, spread evenly over the start
+     * states of all regions. Results only depend on seed, not on the number of threads.
+     * @param num_walks the number of walks.
+     * @param walk_length the number of loops per walk.
+     * @param guard_probability the chance of each guard passing when checked.
+     * @param seed the random seed.
+     * @return coverage of every state and transition, as well as the stuck states found.
+     */
+    ExplorationReport explore_random(size_t num_walks, size_t walk_length, double guard_probability = 0.5,
+                                     unsigned long seed = 0);
+
+};
+
+#endif //ARDUINO
+
+#endif //TINYSTATEMACHINE_TINYSTATEMACHINEEXPLORER_H
@@ -0,0 +1,218 @@
+#ifndef ARDUINO
+
+#include "TinyStateMachineExporter.h"
+#include "algorithm"
+#include "iomanip"
+#include "sstream"
+#include "stdio.h"
+#include "vector"
+
+// escape a string for use inside double quotes, in both DOT and JSON. JSON allows no control characters in strings.
+static std::string escape(const std::string &text) {
+    std::string escaped;
+    for (char c: text) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char code[7];
+                    snprintf(code, sizeof(code), "\\u%04x", (unsigned int) c);
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+// format a number without changing the flags of the output stream.
+static std::string fixed(double value, int precision) {
+    std::ostringstream formatted;
+    formatted << std::fixed << std::setprecision(precision) << value;
+    return formatted.str();
+}
+
+TinyStateMachineExporter::TinyStateMachineExporter(const TinyStateMachine *state_machine) {
+    this->state_machine = state_machine;
+}
+
+void TinyStateMachineExporter::set_state_name(state_t state, const std::string &name) {
+    set_state_name(state_machine, state, name);
+}
+
+void TinyStateMachineExporter::set_state_name(const TinyStateMachine *machine, state_t state,
+                                              const std::string &name) {
+    state_names[std::make_pair(machine, state)] = name;
+}
+
+void TinyStateMachineExporter::write_dot(std::ostream &out) const {
+    out << "digraph TinyStateMachine {\n";
+    out << "    node [shape=box, style=\"rounded,filled\", fillcolor=\"white\"];\n";
+    write_dot_graph(out, state_machine, "s", "    ");
+    out << "}\n";
+}
+
+void TinyStateMachineExporter::write_json(std::ostream &out) const {
+    write_json_graph(out, state_machine, "");
+    out << "\n";
+}
+
+std::string TinyStateMachineExporter::get_state_name(const TinyStateMachine *machine, state_t state) const {
+    auto name = state_names.find(std::make_pair(machine, state));
+    if (name != state_names.end()) return name->second;
+    return std::to_string((unsigned int) state);
+}
+
+void TinyStateMachineExporter::write_dot_graph(std::ostream &out, const TinyStateMachine *machine,
+                                               const std::string &prefix, const std::string &indent) const {
+    size_t num_states = machine->get_num_states();
+    size_t num_transitions = machine->get_num_transitions();
+    size_t num_regions = machine->get_num_regions();
+    bool profiling = machine->is_profiling();
+
+    // the hottest state and the most checked guard set the scale of the heatmap.
+    unsigned long max_time = 0;
+    unsigned long max_evaluations = 0;
+    for (size_t state = 0; state < num_states; state++) max_time = std::max(max_time, machine->get_state_time(state));
+    for (size_t i = 0; i < num_transitions; i++)
+        max_evaluations = std::max(max_evaluations, machine->get_guard_evaluations(i));
+
+    // ANY_STATE transitions start from a point in the region they belong to.
+    std::vector<bool> region_has_any(num_regions, false);
+    for (size_t i = 0; i < num_transitions; i++) {
+        state_t to_state = machine->get_transition_to(i);
+        if (machine->get_transition_from(i) == TinyStateMachine::ANY_STATE && to_state < num_states)
+            region_has_any[machine->get_state_region(to_state)] = true;
+    }
+
+    for (size_t region = 0; region < num_regions; region++) {
+        std::string region_indent = indent;
+        if (num_regions > 1) {
+            out << indent << "subgraph cluster_" << prefix << "region" << region << " {\n";
+            out << indent << "    label=\"region " << region << "\";\n";
+            out << indent << "    style=dashed;\n";
+            region_indent += "    ";
+        }
+
+        if (region_has_any[region])
+            out << region_indent << prefix << "any" << region << " [shape=point, label=\"\"];\n";
+
+        for (size_t state = 0; state < num_states; state++) {
+            if (machine->get_state_region(state) != region) continue;
+
+            std::string id = prefix + std::to_string(state);
+            const TinyStateMachine *child = machine->get_child_state_machine(state);
+            std::string state_indent = region_indent;
+            if (child) {
+                out << region_indent << "subgraph cluster_" << id << " {\n";
+                out << region_indent << "    label=\"" << escape(get_state_name(machine, state)) << "\";\n";
+                state_indent += "    ";
+            }
+
+            std::ostringstream label;
+            label << get_state_name(machine, state);
+            out << state_indent << id << " [";
+            if (machine->get_region_start_state(region) == state) out << "peripheries=2, ";
+            if (profiling) {
+                label << "\n" << machine->get_state_loops(state) << " loops, " << machine->get_state_time(state)
+                      << " time";
+                double heat = max_time ? (double) machine->get_state_time(state) / max_time : 0;
+                out << "fillcolor=\"0.000 " << fixed(heat, 3) << " 1.000\", ";
+            }
+            out << "label=\"" << escape(label.str()) << "\"];\n";
+
+            if (child) {
+                write_dot_graph(out, child, id + "_", state_indent);
+                out << region_indent << "}\n";
+            }
+        }
+
+        if (num_regions > 1) out << indent << "}\n";
+    }
+
+    for (size_t i = 0; i < num_transitions; i++) {
+        state_t from_state = machine->get_transition_from(i);
+        state_t to_state = machine->get_transition_to(i);
+        if (to_state >= num_states) continue;
+
+        if (from_state == TinyStateMachine::ANY_STATE) {
+            out << indent << prefix << "any" << (unsigned int) machine->get_state_region(to_state);
+        } else if (from_state < num_states) {
+            out << indent << prefix << (unsigned int) from_state;
+        } else {
+            continue;
+        }
+        out << " -> " << prefix << (unsigned int) to_state << " [";
+        if (from_state == TinyStateMachine::ANY_STATE) out << "style=dashed, ";
+
+        if (profiling) {
+            unsigned long evaluations = machine->get_guard_evaluations(i);
+            unsigned long passes = machine->get_guard_passes(i);
+            double width = max_evaluations ? 1 + 4.0 * evaluations / max_evaluations : 1;
+            // guards that are checked all the time but never pass are the first candidates for restructuring.
+            if (evaluations > 0 && passes == 0) out << "color=red, ";
+            out << "penwidth=" << fixed(width, 2) << ", ";
+            out << "label=\"" << passes << "/" << evaluations << "\"";
+        } else {
+            out << "label=\"" << i << "\"";
+        }
+        out << "];\n";
+    }
+}
+
+void TinyStateMachineExporter::write_json_graph(std::ostream &out, const TinyStateMachine *machine,
+                                                const std::string &indent) const {
+    size_t num_states = machine->get_num_states();
+    size_t num_transitions = machine->get_num_transitions();
+    bool profiling = machine->is_profiling();
+
+    out << "{\n";
+    out << indent << "  \"regions\": " << machine->get_num_regions() << ",\n";
+
+    out << indent << "  \"states\": [";
+    for (size_t state = 0; state < num_states; state++) {
+        state_t region = machine->get_state_region(state);
+        out << (state ? ",\n" : "\n") << indent << "    {\"id\": " << state
+            << ", \"name\": \"" << escape(get_state_name(machine, state)) << "\""
+            << ", \"region\": " << (unsigned int) region
+            << ", \"start\": " << (machine->get_region_start_state(region) == state ? "true" : "false");
+        if (profiling) {
+            out << ", \"loops\": " << machine->get_state_loops(state)
+                << ", \"time\": " << machine->get_state_time(state);
+        }
+
+        const TinyStateMachine *child = machine->get_child_state_machine(state);
+        if (child) {
+            out << ", \"child\": ";
+            write_json_graph(out, child, indent + "    ");
+        }
+        out << "}";
+    }
+    out << (num_states ? "\n" + indent + "  ],\n" : "],\n");
+
+    out << indent << "  \"transitions\": [";
+    for (size_t i = 0; i < num_transitions; i++) {
+        state_t from_state = machine->get_transition_from(i);
+        out << (i ? ",\n" : "\n") << indent << "    {\"id\": " << i << ", \"from\": ";
+        if (from_state == TinyStateMachine::ANY_STATE) {
+            out << "\"any\"";
+        } else {
+            out << (unsigned int) from_state;
+        }
+        out << ", \"to\": " << (unsigned int) machine->get_transition_to(i);
+        if (profiling) {
+            out << ", \"evaluations\": " << machine->get_guard_evaluations(i)
+                << ", \"passes\": " << machine->get_guard_passes(i);
+        }
+        out << "}";
+    }
+    out << (num_transitions ? "\n" + indent + "  ]\n" : "]\n");
+    out << indent << "}";
+}
+
+#endif //ARDUINO
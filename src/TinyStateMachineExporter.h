@@ -0,0 +1,75 @@
+#pragma once
+
+#ifndef TINYSTATEMACHINE_TINYSTATEMACHINEEXPORTER_H
+#define TINYSTATEMACHINE_TINYSTATEMACHINEEXPORTER_H
+
+// host-side only: the exporter writes to streams and is meant to run on a PC, not a microcontroller.
+#ifndef ARDUINO
+
+#include "TinyStateMachine.h"
+#include "map"
+#include "ostream"
+#include "string"
+#include "utility"
+
+/**
+ * Renders the graph of a TinyStateMachine (states, regions, transitions, ANY_STATE transitions and child state
+ * machines) to Graphviz DOT or JSON.
+ *
+ * If profiling is enabled on a state machine, its counters are added as a heatmap: states are shaded by the time spent
+ * in them, transitions are drawn thicker the more often their guard is checked, and guards that are checked but never
+ * pass are drawn in red.
+ */
+class TinyStateMachineExporter {
+
+private:
+    const TinyStateMachine *state_machine;
+    std::map<std::pair<const TinyStateMachine *, state_t>, std::string> state_names;
+
+    std::string get_state_name(const TinyStateMachine *machine, state_t state) const;
+
+    void write_dot_graph(std::ostream &out, const TinyStateMachine *machine, const std::string &prefix,
+                         const std::string &indent) const;
+
+    void write_json_graph(std::ostream &out, const TinyStateMachine *machine, const std::string &indent) const;
+
+public:
+    /**
+     * Constructor.
+     * @param state_machine the state machine to export. Only read, never run.
+     */
+    explicit TinyStateMachineExporter(const TinyStateMachine *state_machine);
+
+    /**
+     * Name a state of the exported state machine. States without a name are labeled with their number.
+     * @param state the state to name.
+     * @param name the label to show.
+     */
+    void set_state_name(state_t state, const std::string &name);
+
+    /**
+     * Name a state of a child state machine. States without a name are labeled with their number.
+     * @param machine the (child) state machine the state belongs to.
+     * @param state the state to name.
+     * @param name the label to show.
+     */
+    void set_state_name(const TinyStateMachine *machine, state_t state, const std::string &name);
+
+    /**
+     * Write the graph in Graphviz DOT format. Regions and child state machines are drawn as clusters.
+     * @param out the stream to write to.
+     */
+    void write_dot(std::ostream &out) const;
+
+    /**
+     * Write the graph as JSON: an object with "regions", "states" and "transitions". Child state machines are nested
+     * objects of the same shape under their parent state.
+     * @param out the stream to write to.
+     */
+    void write_json(std::ostream &out) const;
+
+};
+
+#endif //ARDUINO
+
+#endif //TINYSTATEMACHINE_TINYSTATEMACHINEEXPORTER_H
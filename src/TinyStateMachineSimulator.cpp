@@ -0,0 +1,127 @@
+#ifndef ARDUINO
+
+#include "TinyStateMachineSimulator.h"
+#include "sstream"
+
+TinyStateMachineSimulator::TinyStateMachineSimulator(TinyStateMachine *state_machine) {
+    this->state_machine = state_machine;
+    this->inputs = std::unordered_map<std::string, long *>();
+}
+
+bool TinyStateMachineSimulator::add_input(const std::string &channel, long *value) {
+    if (value == nullptr) return false;
+
+    inputs[channel] = value;
+    return true;
+}
+
+void TinyStateMachineSimulator::set_max_steps_per_instant(size_t max_steps) {
+    this->max_steps_per_instant = max_steps;
+}
+
+sim_time_t TinyStateMachineSimulator::millis() const {
+    return now;
+}
+
+bool TinyStateMachineSimulator::after(sim_time_t deadline) {
+    if (now >= deadline) return true;
+
+    // remember the earliest deadline any guard is waiting on, so run() can jump straight to it.
+    if (deadline < next_deadline) next_deadline = deadline;
+    return false;
+}
+
+bool TinyStateMachineSimulator::in_state_for(sim_time_t duration, state_t region) {
+    if (region >= state_entered_at.size()) return false;
+    return after(state_entered_at[region] + duration);
+}
+
+bool TinyStateMachineSimulator::run(std::istream &trace, std::ostream &log, sim_time_t end_time) {
+    now = 0;
+    state_entered_at.assign(state_machine->get_num_regions(), 0);
+    region_states.assign(state_machine->get_num_regions(), TinyStateMachine::NULL_STATE);
+    num_transitions = 0;
+    next_deadline = NO_DEADLINE;
+
+    state_machine->startup();
+
+    InputEvent event;
+    int has_event = read_event(trace, event);
+
+    while (true) {
+        if (has_event < 0) return false;
+
+        // apply every event that is due, then let the machine react to them.
+        while (has_event > 0 && event.time <= now) {
+            apply_event(event);
+            has_event = read_event(trace, event);
+            if (has_event < 0) return false;
+        }
+
+        if (!settle(log)) return false;
+
+        // the machine is idle until either the next input or the next deadline, whichever comes first.
+        sim_time_t next_time = next_deadline;
+        if (has_event > 0 && event.time < next_time) next_time = event.time;
+
+        if (next_time == NO_DEADLINE) return true;
+        if (next_time > end_time) {
+            // stopping early only counts as success if nothing in the trace was left unread.
+            now = end_time;
+            return has_event == 0;
+        }
+        now = next_time;
+    }
+}
+
+size_t TinyStateMachineSimulator::get_num_transitions() const {
+    return num_transitions;
+}
+
+bool TinyStateMachineSimulator::settle(std::ostream &log) {
+    for (size_t step = 0; step <= max_steps_per_instant; step++) {
+        for (size_t region = 0; region < region_states.size(); region++) {
+            region_states[region] = state_machine->get_region_state(region);
+        }
+
+        // only deadlines requested during the last, idle loop() matter, so start fresh on every pass.
+        next_deadline = NO_DEADLINE;
+        state_machine->loop();
+
+        bool transitioned = false;
+        for (size_t region = 0; region < region_states.size(); region++) {
+            state_t from_state = region_states[region];
+            state_t to_state = state_machine->get_region_state(region);
+            if (to_state == from_state) continue;
+
+            log << now << ' ' << region << ' ' << (unsigned int) from_state << ' ' << (unsigned int) to_state << '\n';
+            state_entered_at[region] = now;
+            num_transitions++;
+            transitioned = true;
+        }
+        if (!transitioned) return true;
+    }
+    return false;
+}
+
+int TinyStateMachineSimulator::read_event(std::istream &trace, InputEvent &event) {
+    std::string line;
+    while (std::getline(trace, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        std::istringstream fields(line);
+        if (!(fields >> event.time >> event.channel >> event.value)) return -1;
+        return 1;
+    }
+    return 0;
+}
+
+void TinyStateMachineSimulator::apply_event(const InputEvent &event) {
+    auto input = inputs.find(event.channel);
+    if (input == inputs.end()) return;
+
+    *input->second = event.value;
+}
+
+#endif //ARDUINO
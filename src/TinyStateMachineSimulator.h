@@ -0,0 +1,131 @@
+#pragma once
+
+#ifndef TINYSTATEMACHINE_TINYSTATEMACHINESIMULATOR_H
+#define TINYSTATEMACHINE_TINYSTATEMACHINESIMULATOR_H
+
+// host-side only: the simulator reads traces from streams and is meant to run on a PC, not a microcontroller.
+#ifndef ARDUINO
+
+#include "TinyStateMachine.h"
+#include "istream"
+#include "ostream"
+#include "string"
+#include "unordered_map"
+#include "vector"
+
+typedef unsigned long sim_time_t;
+
+/**
+ * Deterministic simulation harness for a TinyStateMachine. Instead of ticking loop() in real time, the simulator keeps
+ * a virtual clock and jumps straight to the next point where something can change: either the next event in the input
+ * trace or the next deadline a guard asked for through after() or in_state_for().
+ *
+ * Guards and state funcs should read time through the simulator (millis(), after(), in_state_for()) rather than
+ * the Arduino millis(). Loop funcs are only run at those instants, so they should depend on time and inputs, not on
+ * how many times they have been called.
+ *
+ * Input trace format: one event per line, "<time_ms> <channel> <value>", sorted by time. Blank lines and lines
+ * starting with '#' are skipped. Channels that were not registered with add_input() are ignored.
+ *
+ * Transition log format: one transition per line, "<time_ms> <region> <from_state> <to_state>". Every region of the
+ * state machine is tracked.
+ */
+class TinyStateMachineSimulator {
+
+private:
+    struct InputEvent {
+        sim_time_t time;
+        std::string channel;
+        long value;
+    };
+
+    TinyStateMachine *state_machine;
+    std::unordered_map<std::string, long *> inputs;
+
+    sim_time_t now = 0;
+    std::vector<sim_time_t> state_entered_at; // per region
+    std::vector<state_t> region_states; // scratch space for settle()
+    sim_time_t next_deadline = 0;
+    size_t max_steps_per_instant = 1000;
+    size_t num_transitions = 0;
+
+    /**
+     * Run loop() until no region of the state machine transitions at the current time, logging every transition.
+     * @return true if the state machine settled, false if it was still transitioning after max_steps_per_instant.
+     */
+    bool settle(std::ostream &log);
+
+    /**
+     * Read the next event from the trace.
+     * @return 1 if an event was read, 0 at the end of the trace, -1 if the line was malformed.
+     */
+    int read_event(std::istream &trace, InputEvent &event);
+
+    void apply_event(const InputEvent &event);
+
+public:
+    static const sim_time_t NO_DEADLINE = (sim_time_t) -1;
+
+    /**
+     * Constructor.
+     * @param state_machine the state machine to drive. Should be fully set up, but not started.
+     */
+    explicit TinyStateMachineSimulator(TinyStateMachine *state_machine);
+
+    /**
+     * Register an input channel. When an event for this channel is replayed, its value is written to value.
+     * @param channel the channel name used in the input trace.
+     * @param value the variable the guards read the input from. Declarative guards can read it as GuardVariable(value).
+     * @return true if the channel was added, false otherwise (e.g. null pointer).
+     */
+    bool add_input(const std::string &channel, long *value);
+
+    /**
+     * Set how many transitions may happen at a single instant before the machine is considered stuck in a cycle.
+     * @param max_steps the maximum number of transitions at one instant.
+     */
+    void set_max_steps_per_instant(size_t max_steps);
+
+    /**
+     * @return the current virtual time in milliseconds.
+     */
+    sim_time_t millis() const;
+
+    /**
+     * Check a deadline against the virtual clock. If the deadline hasn't passed yet, the simulator will wake up at it.
+     * @param deadline the virtual time to wait for.
+     * @return true if the virtual time is at or after deadline, false otherwise.
+     */
+    bool after(sim_time_t deadline);
+
+    /**
+     * Check how long a region of the state machine has been in its current state. Use this instead of storing millis()
+     * in an enter func for timeouts.
+     * @param duration the time the state must have been active for.
+     * @param region the region to check. Defaults to the first region.
+     * @return true if the current state of the region has been active for at least duration, false otherwise.
+     */
+    bool in_state_for(sim_time_t duration, state_t region = 0);
+
+    /**
+     * Replay a trace through the state machine. Calls startup() at virtual time 0, then advances the virtual clock from
+     * event to event and deadline to deadline until the trace is exhausted and no deadlines are pending, or end_time is
+     * reached.
+     * @param trace the input trace. Read one line at a time, so it can be arbitrarily long.
+     * @param log stream that every transition is written to.
+     * @param end_time the virtual time to stop at.
+     * @return true if the whole trace was replayed, false otherwise (malformed trace, a transition cycle, or events left
+     * after end_time). Deadlines still pending at end_time don't count as unreplayed.
+     */
+    bool run(std::istream &trace, std::ostream &log, sim_time_t end_time = NO_DEADLINE);
+
+    /**
+     * @return the number of transitions that happened during the last run(), in all regions.
+     */
+    size_t get_num_transitions() const;
+
+};
+
+#endif //ARDUINO
+
+#endif //TINYSTATEMACHINE_TINYSTATEMACHINESIMULATOR_H
@@ -7,19 +7,660 @@
 #else
 
 #include "TinyStateMachine.h"
+#include "TinyStateMachineSimulator.h"
+#include "TinyStateMachineExplorer.h"
+#include "TinyStateMachineExporter.h"
+#include "sstream"
 
 int main(int num_args, char* args[]) {
 
     ::testing::InitGoogleTest(&num_args, args);
 
-    RUN_ALL_TESTS();
-
-    return 0;
+    return RUN_ALL_TESTS();
 }
 
 TEST(TinyStateMachine, AddStates) {
     TinyStateMachine tsm = TinyStateMachine(5, 10);
 
 }
-#endif
 
+TEST(TinyStateMachine, WideIndexTypes) {
+    static_assert(std::is_same<SizedTinyStateMachine<253, 255>, TinyStateMachine>::value, "8-bit machine");
+    static_assert(std::is_same<SizedTinyStateMachine<254, 256>::state_t, uint16_t>::value, "16-bit states");
+    static_assert(std::is_same<SizedTinyStateMachine<254, 256>::transition_t, uint16_t>::value, "16-bit transitions");
+    static_assert(std::is_same<SizedTinyStateMachine<70000, 10>::state_t, uint32_t>::value, "32-bit states");
+
+    // 8-bit transitions stop at MAX_TRANSITIONS instead of wrapping around.
+    TinyStateMachine narrow = TinyStateMachine();
+    narrow.add_state();
+    for (int i = 0; i < TinyStateMachine::MAX_TRANSITIONS; i++) {
+        ASSERT_TRUE(narrow.add_transition(0, 0, [] { return false; }));
+    }
+    EXPECT_FALSE(narrow.add_transition(0, 0, [] { return false; }));
+
+    typedef SizedTinyStateMachine<2000, 2000> WideStateMachine;
+    WideStateMachine wide = WideStateMachine(2000, 2000);
+    int counter = 0;
+    for (int i = 0; i < 2000; i++) ASSERT_EQ(wide.add_state(), i);
+    EXPECT_EQ(wide.add_state(), WideStateMachine::NULL_STATE);
+    for (int i = 0; i < 1999; i++) {
+        ASSERT_TRUE(wide.add_transition(i, i + 1, [&counter, i] { return counter > i; }));
+    }
+
+    wide.startup();
+    for (counter = 1; counter < 2000; counter++) wide.loop();
+    EXPECT_EQ(wide.get_current_state(), 1999);
+
+    // children can only be added to existing states, however wide the state type is.
+    typedef SizedTinyStateMachine<70000, 10> WidestStateMachine;
+    WidestStateMachine widest = WidestStateMachine();
+    WidestStateMachine child = WidestStateMachine();
+    widest.add_state();
+    EXPECT_FALSE(widest.add_child_state_machine(4000000000u, &child));
+    EXPECT_TRUE(widest.add_child_state_machine(0, &child));
+}
+
+TEST(TinyStateMachine, OrthogonalRegions) {
+    TinyStateMachine tsm = TinyStateMachine();
+    int light_loops = 0;
+    bool button = false;
+
+    // region 0: a light that is switched by the button.
+    state_t off = tsm.add_state();
+    state_t on = tsm.add_state_loop([&light_loops] { light_loops++; });
+
+    // region 1: a fan that follows the light, one loop behind.
+    state_t fan_region = tsm.add_region();
+    state_t fan_off = tsm.add_state();
+    state_t fan_on = tsm.add_state();
+    state_t fan_error = tsm.add_state();
+
+    tsm.add_transition(off, on, [&button] { return button; });
+    tsm.add_transition(on, off, [&button] { return !button; });
+    tsm.add_transition(fan_off, fan_on, [&tsm, on] { return tsm.in_state(on); });
+    tsm.add_transition(fan_on, fan_off, [&tsm, off] { return tsm.in_state(off); });
+    // only resets the fan region; the light is not affected.
+    tsm.add_transition(TinyStateMachine::ANY_STATE, fan_error, [&light_loops] { return light_loops == 3; });
+
+    EXPECT_EQ(fan_region, 1);
+    EXPECT_EQ(tsm.get_num_regions(), 2u);
+    EXPECT_EQ(tsm.get_state_region(fan_on), fan_region);
+
+    tsm.startup();
+    EXPECT_TRUE(tsm.in_state(off));
+    EXPECT_TRUE(tsm.in_state(fan_off));
+
+    button = true;
+    tsm.loop();
+    // guards see the states from before the loop, so the fan hasn't noticed the light yet.
+    EXPECT_EQ(tsm.get_current_state(), on);
+    EXPECT_EQ(tsm.get_region_state(fan_region), fan_off);
+
+    tsm.loop();
+    EXPECT_EQ(tsm.get_region_state(fan_region), fan_on);
+
+    tsm.loop();
+    tsm.loop();
+    EXPECT_EQ(light_loops, 3);
+    EXPECT_TRUE(tsm.in_state(on));
+    EXPECT_TRUE(tsm.in_state(fan_error));
+}
+
+TEST(TinyStateMachine, OnlyChecksTransitionsOfActiveStates) {
+    TinyStateMachine tsm = TinyStateMachine();
+    bool go = false;
+    state_t a = tsm.add_state();
+    state_t b = tsm.add_state();
+    state_t c = tsm.add_state();
+    tsm.add_region();
+    state_t d = tsm.add_state();
+
+    tsm.add_transition(b, c, [] { return true; });
+    // added before the transition from a, so it is checked first.
+    tsm.add_transition(TinyStateMachine::ANY_STATE, c, [&go] { return go; });
+    tsm.add_transition(a, b, [] { return true; });
+    tsm.add_transition(d, d, [] { return true; });
+    tsm.enable_profiling();
+
+    tsm.startup();
+    tsm.loop();
+    EXPECT_TRUE(tsm.in_state(b));
+    // the transition from b wasn't active, and the other region's transitions don't count against this one.
+    EXPECT_EQ(tsm.get_guard_evaluations(0), 0u);
+    EXPECT_EQ(tsm.get_guard_evaluations(1), 1u);
+    EXPECT_EQ(tsm.get_guard_evaluations(2), 1u);
+    EXPECT_EQ(tsm.get_guard_evaluations(3), 1u);
+
+    // transitions added after startup() are picked up by the next loop().
+    tsm.add_transition(c, a, [] { return true; });
+    go = true;
+    tsm.loop();
+    EXPECT_TRUE(tsm.in_state(c));
+    tsm.loop();
+    EXPECT_TRUE(tsm.in_state(c));
+    go = false;
+    tsm.loop();
+    EXPECT_TRUE(tsm.in_state(a));
+    EXPECT_EQ(tsm.get_guard_passes(4), 1u);
+}
+
+TEST(TinyStateMachine, RejectsTransitionsBetweenRegions) {
+    TinyStateMachine tsm = TinyStateMachine();
+    int value = 1;
+    state_t a = tsm.add_state();
+    tsm.add_state();
+    // added before the states exist, so it can only be caught at startup().
+    EXPECT_TRUE(tsm.add_transition(a, 3, [] { return true; }));
+    tsm.add_region();
+    state_t c = tsm.add_state();
+    tsm.add_state();
+
+    EXPECT_FALSE(tsm.add_transition(a, c, [] { return true; }));
+    EXPECT_FALSE(tsm.add_transition(c, a, GuardVariable(&value) == 1));
+    EXPECT_EQ(tsm.get_num_transitions(), 1u);
+
+    tsm.startup();
+    tsm.loop();
+    EXPECT_TRUE(tsm.in_state(a));
+    EXPECT_TRUE(tsm.in_state(c));
+}
+
+TEST(TinyStateMachine, ChildHistory) {
+    TinyStateMachine parent = TinyStateMachine();
+    TinyStateMachine shallow_child = TinyStateMachine();
+    TinyStateMachine grandchild = TinyStateMachine();
+    bool active = false;
+    int start_enters = 0;
+    int child_loops = 0;
+    int grandchild_exits = 0;
+
+    state_t idle = parent.add_state();
+    state_t running = parent.add_state();
+    parent.add_transition(idle, running, [&active] { return active; });
+    parent.add_transition(running, idle, [&active] { return !active; });
+
+    // the child steps through three states, one per loop, and stays in the last one.
+    shallow_child.add_state_el([&start_enters] { start_enters++; }, [&child_loops] { child_loops++; });
+    shallow_child.add_state();
+    state_t nested = shallow_child.add_state();
+    shallow_child.add_transition(0, 1, [] { return true; });
+    shallow_child.add_transition(1, nested, [] { return true; });
+
+    grandchild.add_state_exit([&grandchild_exits] { grandchild_exits++; });
+    grandchild.add_state();
+    grandchild.add_transition(0, 1, [] { return true; });
+
+    EXPECT_TRUE(parent.add_child_state_machine(running, &shallow_child, SHALLOW_HISTORY));
+    EXPECT_FALSE(parent.add_child_state_machine(running, &grandchild));
+    EXPECT_TRUE(shallow_child.add_child_state_machine(nested, &grandchild));
+
+    parent.startup();
+    parent.loop();
+    // the child isn't looped while its parent state is inactive.
+    EXPECT_EQ(child_loops, 0);
+    EXPECT_EQ(start_enters, 0);
+
+    active = true;
+    parent.loop(); // enter running, which starts the child.
+    parent.loop(); // child: 0 -> 1
+    parent.loop(); // child: 1 -> nested, which starts the grandchild.
+    parent.loop(); // grandchild: 0 -> 1
+    EXPECT_EQ(start_enters, 1);
+    EXPECT_EQ(child_loops, 1);
+    EXPECT_EQ(grandchild_exits, 1);
+    EXPECT_EQ(shallow_child.get_current_state(), nested);
+
+    active = false;
+    parent.loop();
+    active = true;
+    parent.loop();
+    // the child resumed in nested without being started again, but the grandchild has no history and restarted.
+    EXPECT_EQ(start_enters, 1);
+    EXPECT_EQ(shallow_child.get_current_state(), nested);
+    EXPECT_EQ(grandchild.get_current_state(), 0);
+}
+
+TEST(TinyStateMachine, DeclarativeGuards) {
+    TinyStateMachine tsm = TinyStateMachine();
+    int counter = 0;
+    int limit = 5;
+    int enabled = 0;
+
+    state_t ascending = tsm.add_state_loop([&counter] { counter++; });
+    state_t descending = tsm.add_state_loop([&counter] { counter--; });
+    state_t stopped = tsm.add_state();
+
+    tsm.add_transition(ascending, stopped,
+                       GuardVariable(&counter) >= 100 || (GuardVariable(&counter) < 0 && GuardVariable(&enabled)));
+    tsm.add_transition(ascending, descending,
+                       GuardVariable(&counter) >= GuardVariable(&limit) && GuardVariable(&enabled) == 1);
+    tsm.add_transition(descending, ascending, GuardVariable(&counter) <= 0);
+    tsm.add_transition(stopped, ascending, GuardExpression());
+
+    tsm.startup();
+    for (int i = 0; i < 10; i++) tsm.loop();
+    // not enabled yet, so the counter keeps going up.
+    EXPECT_EQ(tsm.get_current_state(), ascending);
+    EXPECT_EQ(counter, 10);
+
+    enabled = 1;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), descending);
+    for (int i = 0; i < 11; i++) tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), ascending);
+    EXPECT_EQ(counter, 0);
+
+    counter = -10;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), stopped);
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), ascending);
+
+    // guards that read a null variable would crash loop(), so they are never added.
+    const int *missing = nullptr;
+    EXPECT_FALSE(tsm.add_transition(stopped, ascending, GuardVariable(missing) == 1));
+    EXPECT_FALSE(tsm.add_transition(stopped, ascending, GuardVariable(&counter) == 1 || GuardVariable(missing)));
+    EXPECT_FALSE(tsm.add_transition(stopped, ascending, GuardVariable(&counter) < GuardVariable(missing)));
+    // variables of different types can't be compared to each other.
+    long wide_limit = 5;
+    EXPECT_FALSE(tsm.add_transition(stopped, ascending, GuardVariable(&counter) < GuardVariable(&wide_limit)));
+    EXPECT_EQ(tsm.get_num_transitions(), 4u);
+}
+
+TEST(TinyStateMachine, DeclarativeGuardTypes) {
+    TinyStateMachine tsm = TinyStateMachine();
+    uint8_t ready = 0;
+    unsigned long now = 0;
+    unsigned long timeout = 4000000000ul;
+    long temperature = -20;
+
+    state_t waiting = tsm.add_state();
+    state_t heating = tsm.add_state();
+    state_t timed_out = tsm.add_state();
+    tsm.add_transition(waiting, heating, GuardVariable(&ready) && GuardVariable(&temperature) < -10);
+    tsm.add_transition(heating, timed_out, GuardVariable(&now) >= GuardVariable(&timeout));
+    tsm.add_transition(timed_out, waiting, GuardVariable(&ready) == 255);
+
+    tsm.startup();
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), waiting);
+    ready = 1;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), heating);
+
+    // too large for an int, and for a long where long has 32 bits.
+    now = 3999999999ul;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), heating);
+    now = 4000000000ul;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), timed_out);
+
+    ready = 255;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), waiting);
+}
+
+TEST(TinyStateMachine, DeclarativeGuardsKeepTheirShape) {
+    // (v0 || v1) && (v2 || v3) && ... takes one comparison per variable, not one clause per combination.
+    int values[32] = {0};
+    GuardExpression guard = GuardVariable(&values[0]) || GuardVariable(&values[1]);
+    for (int i = 2; i < 32; i += 2) guard = guard && (GuardVariable(&values[i]) || GuardVariable(&values[i + 1]));
+    EXPECT_EQ(guard.conditions.size(), 32u);
+
+    TinyStateMachine tsm = TinyStateMachine();
+    tsm.add_state();
+    tsm.add_state();
+    ASSERT_TRUE(tsm.add_transition(0, 1, guard));
+    ASSERT_TRUE(tsm.add_transition(1, 0, GuardExpression() && GuardVariable(&values[0]) == 0));
+    tsm.startup();
+
+    // every pair but the last has one variable set.
+    for (int i = 0; i < 30; i += 2) values[i + (i / 2) % 2] = 1;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), 0);
+    values[31] = 1;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), 1);
+
+    values[0] = 0;
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), 0);
+    // the first pair now fails, whatever the rest say.
+    tsm.loop();
+    EXPECT_EQ(tsm.get_current_state(), 0);
+}
+
+TEST(TinyStateMachine, ChildDeepHistory) {
+    TinyStateMachine parent = TinyStateMachine();
+    TinyStateMachine deep_child = TinyStateMachine();
+    TinyStateMachine grandchild = TinyStateMachine();
+    bool active = false;
+    int grandchild_start_enters = 0;
+
+    state_t idle = parent.add_state();
+    state_t running = parent.add_state();
+    parent.add_transition(idle, running, [&active] { return active; });
+    parent.add_transition(running, idle, [&active] { return !active; });
+
+    deep_child.add_state();
+    state_t nested = deep_child.add_state();
+    deep_child.add_transition(0, nested, [] { return true; });
+
+    grandchild.add_state_enter([&grandchild_start_enters] { grandchild_start_enters++; });
+    grandchild.add_state();
+    grandchild.add_transition(0, 1, [] { return true; });
+
+    // the grandchild has no history of its own; the deep history of its ancestor overrides that.
+    EXPECT_TRUE(parent.add_child_state_machine(running, &deep_child, DEEP_HISTORY));
+    EXPECT_TRUE(deep_child.add_child_state_machine(nested, &grandchild));
+
+    parent.startup();
+    active = true;
+    parent.loop(); // enter running, which starts the child.
+    parent.loop(); // child: 0 -> nested, which starts the grandchild.
+    parent.loop(); // grandchild: 0 -> 1
+    EXPECT_EQ(grandchild_start_enters, 1);
+    EXPECT_EQ(grandchild.get_current_state(), 1);
+
+    active = false;
+    parent.loop();
+    active = true;
+    parent.loop();
+    EXPECT_EQ(deep_child.get_current_state(), nested);
+    EXPECT_EQ(grandchild.get_current_state(), 1);
+    EXPECT_EQ(grandchild_start_enters, 1);
+}
+
+TEST(TinyStateMachineSimulator, ReplaysTraceInVirtualTime) {
+    TinyStateMachine tsm = TinyStateMachine(2, 2);
+    TinyStateMachineSimulator sim = TinyStateMachineSimulator(&tsm);
+    long door = 0;
+    sim.add_input("door", &door);
+
+    state_t closed = tsm.add_state();
+    state_t open = tsm.add_state();
+    tsm.add_transition(closed, open, [&door] { return door == 1; });
+    // the door closes by itself 30 seconds after it was opened.
+    tsm.add_transition(open, closed, [&sim, &door] {
+        if (!sim.in_state_for(30000)) return false;
+        door = 0;
+        return true;
+    });
+
+    std::istringstream trace("# time channel value\n"
+                             "1000 door 1\n"
+                             "5000 unknown 3\n"
+                             "86400000 door 1\n");
+    std::ostringstream log;
+
+    ASSERT_TRUE(sim.run(trace, log));
+    EXPECT_EQ(log.str(), "1000 0 0 1\n31000 0 1 0\n86400000 0 0 1\n86430000 0 1 0\n");
+    EXPECT_EQ(sim.get_num_transitions(), 4u);
+    EXPECT_EQ(sim.millis(), 86430000ul);
+}
+
+TEST(TinyStateMachineSimulator, DrivesDeclarativeGuards) {
+    TinyStateMachine tsm = TinyStateMachine();
+    TinyStateMachineSimulator sim = TinyStateMachineSimulator(&tsm);
+    long level = 0;
+    sim.add_input("level", &level);
+
+    tsm.add_state();
+    tsm.add_state();
+    tsm.add_transition(0, 1, GuardVariable(&level) > 100);
+    tsm.add_transition(1, 0, GuardVariable(&level) <= 10);
+
+    std::istringstream trace("100 level 50\n200 level 150\n300 level 5\n");
+    std::ostringstream log;
+
+    ASSERT_TRUE(sim.run(trace, log));
+    EXPECT_EQ(log.str(), "200 0 0 1\n300 0 1 0\n");
+}
+
+TEST(TinyStateMachineSimulator, TracksEveryRegion) {
+    TinyStateMachine tsm = TinyStateMachine();
+    TinyStateMachineSimulator sim = TinyStateMachineSimulator(&tsm);
+    long go = 0;
+    sim.add_input("go", &go);
+
+    tsm.add_state();
+    tsm.add_region();
+    state_t waiting = tsm.add_state();
+    state_t moving = tsm.add_state();
+    state_t arrived = tsm.add_state();
+    state_t resting = tsm.add_state();
+    tsm.add_transition(waiting, moving, [&go] { return go == 1; });
+    tsm.add_transition(moving, arrived, [] { return true; });
+    tsm.add_transition(arrived, resting, [&sim] { return sim.in_state_for(500, 1); });
+
+    std::istringstream trace("100 go 1\n");
+    std::ostringstream log;
+
+    ASSERT_TRUE(sim.run(trace, log));
+    EXPECT_EQ(log.str(), "100 1 1 2\n100 1 2 3\n600 1 3 4\n");
+    EXPECT_EQ(tsm.get_region_state(1), resting);
+    EXPECT_EQ(sim.get_num_transitions(), 3u);
+}
+
+TEST(TinyStateMachineSimulator, StopsAtEndTime) {
+    TinyStateMachine tsm = TinyStateMachine();
+    TinyStateMachineSimulator sim = TinyStateMachineSimulator(&tsm);
+    long door = 0;
+    sim.add_input("door", &door);
+    tsm.add_state();
+    tsm.add_state();
+    tsm.add_transition(0, 1, [&door] { return door == 1; });
+    tsm.add_transition(1, 0, [&sim] { return sim.in_state_for(1000); });
+
+    std::istringstream unread_trace("100 door 1\n5000 door 1\n");
+    std::ostringstream log;
+    EXPECT_FALSE(sim.run(unread_trace, log, 2000));
+    EXPECT_EQ(sim.millis(), 2000ul);
+
+    // the deadline at 1100 is still pending at end_time, but the whole trace was read.
+    std::istringstream full_trace("100 door 1\n");
+    EXPECT_TRUE(sim.run(full_trace, log, 500));
+    EXPECT_EQ(sim.millis(), 500ul);
+}
+
+TEST(TinyStateMachineSimulator, RejectsMalformedTrace) {
+    TinyStateMachine tsm = TinyStateMachine(1, 0);
+    TinyStateMachineSimulator sim = TinyStateMachineSimulator(&tsm);
+    tsm.add_state();
+
+    std::istringstream trace("10 door\n");
+    std::ostringstream log;
+
+    EXPECT_FALSE(sim.run(trace, log));
+}
+
+TEST(TinyStateMachineExplorer, CoversFullSizeGraph) {
+    TinyStateMachine tsm = TinyStateMachine();
+    while (tsm.add_state() != TinyStateMachine::NULL_STATE);
+    ASSERT_EQ(tsm.get_num_states(), 253u);
+
+    // a ring through every state, except the last state which can only be entered, never left.
+    for (state_t state = 0; state < 251; state++) tsm.add_transition(state, state + 1, [] { return true; });
+    tsm.add_transition(251, 0, [] { return true; });
+    tsm.add_transition(TinyStateMachine::ANY_STATE, 252, [] { return true; });
+
+    TinyStateMachineExplorer explorer = TinyStateMachineExplorer(&tsm);
+    explorer.set_num_threads(4);
+    ExplorationReport report = explorer.explore(1000, 2);
+
+    EXPECT_TRUE(report.complete);
+    EXPECT_TRUE(report.unvisited_states.empty());
+    EXPECT_EQ(report.dead_end_states, std::vector<state_t>({252}));
+    EXPECT_EQ(report.trap_states, std::vector<state_t>({252}));
+    for (unsigned long fires: report.transition_fires) EXPECT_GT(fires, 0u);
+}
+
+TEST(TinyStateMachineExplorer, RandomWalksIndependentOfThreads) {
+    TinyStateMachine tsm = TinyStateMachine(4, 5);
+    for (int i = 0; i < 4; i++) tsm.add_state();
+    tsm.add_transition(0, 1, [] { return true; });
+    tsm.add_transition(0, 2, [] { return true; });
+    tsm.add_transition(1, 0, [] { return true; });
+    tsm.add_transition(2, 3, [] { return true; });
+    tsm.add_transition(3, 0, [] { return true; });
+
+    TinyStateMachineExplorer explorer = TinyStateMachineExplorer(&tsm);
+    explorer.set_num_threads(1);
+    ExplorationReport single = explorer.explore_random(500, 100, 0.3, 42);
+    explorer.set_num_threads(8);
+    ExplorationReport parallel = explorer.explore_random(500, 100, 0.3, 42);
+
+    EXPECT_EQ(single.state_visits, parallel.state_visits);
+    EXPECT_EQ(single.transition_fires, parallel.transition_fires);
+    EXPECT_EQ(single.num_stuck_walks, 0u);
+    EXPECT_TRUE(single.unvisited_states.empty());
+}
+
+TEST(TinyStateMachineExplorer, EnumerationIndependentOfThreads) {
+    // every state branches twice, so the frontier grows past a single chunk of work and the workers share it.
+    TinyStateMachine tsm = TinyStateMachine();
+    for (int i = 0; i < 16; i++) tsm.add_state();
+    for (state_t state = 0; state < 16; state++) {
+        tsm.add_transition(state, (state + 1) % 16, [] { return true; });
+        tsm.add_transition(state, (state * 3 + 5) % 16, [] { return true; });
+    }
+
+    TinyStateMachineExplorer explorer = TinyStateMachineExplorer(&tsm);
+    explorer.set_num_threads(1);
+    ExplorationReport single = explorer.explore(20, 7);
+    explorer.set_num_threads(8);
+    ExplorationReport parallel = explorer.explore(20, 7);
+
+    EXPECT_GT(single.num_sequences, 1000u);
+    EXPECT_EQ(single.num_sequences, parallel.num_sequences);
+    EXPECT_EQ(single.state_visits, parallel.state_visits);
+    EXPECT_EQ(single.transition_fires, parallel.transition_fires);
+    EXPECT_EQ(single.complete, parallel.complete);
+}
+
+TEST(TinyStateMachineExplorer, SelfLoopsAreTakenButNotStuck) {
+    TinyStateMachine tsm = TinyStateMachine();
+    tsm.add_state();
+    tsm.add_state();
+    tsm.add_transition(0, 0, [] { return true; });
+    tsm.add_transition(0, 1, [] { return true; });
+    tsm.add_transition(1, 0, [] { return true; });
+
+    TinyStateMachineExplorer explorer = TinyStateMachineExplorer(&tsm);
+    ExplorationReport random = explorer.explore_random(1000, 100, 0.5, 1);
+    EXPECT_EQ(random.num_stuck_walks, 0u);
+    EXPECT_TRUE(random.dead_end_states.empty());
+    EXPECT_GT(random.transition_fires[0], 0u);
+
+    ExplorationReport enumerated = explorer.explore(10);
+    EXPECT_GT(enumerated.transition_fires[0], 0u);
+    EXPECT_TRUE(enumerated.complete);
+}
+
+TEST(TinyStateMachineExplorer, StartHasNoHistory) {
+    // the same two state cycle, once started from 0 and once from 1. Starting in a state is not the same sequence as
+    // coming from state 0 into it.
+    size_t num_sequences[2];
+    for (state_t start_state = 0; start_state < 2; start_state++) {
+        TinyStateMachine tsm = TinyStateMachine();
+        tsm.add_state();
+        tsm.add_state();
+        tsm.set_start_state(start_state);
+        tsm.add_transition(0, 1, [] { return true; });
+        tsm.add_transition(1, 0, [] { return true; });
+
+        ExplorationReport report = TinyStateMachineExplorer(&tsm).explore(10, 1);
+        EXPECT_TRUE(report.complete);
+        num_sequences[start_state] = report.num_sequences;
+    }
+    EXPECT_EQ(num_sequences[0], 3u);
+    EXPECT_EQ(num_sequences[1], 3u);
+}
+
+TEST(TinyStateMachineExplorer, ExploresEveryRegion) {
+    TinyStateMachine tsm = TinyStateMachine();
+    tsm.add_state();
+    tsm.add_state();
+    tsm.add_region();
+    tsm.add_state();
+    tsm.add_state();
+    tsm.add_transition(0, 1, [] { return true; });
+    tsm.add_transition(1, 0, [] { return true; });
+    tsm.add_transition(TinyStateMachine::ANY_STATE, 3, [] { return true; });
+
+    ExplorationReport report = TinyStateMachineExplorer(&tsm).explore(10);
+
+    EXPECT_TRUE(report.unvisited_states.empty());
+    EXPECT_EQ(report.dead_end_states, std::vector<state_t>({3}));
+    EXPECT_EQ(report.trap_states, std::vector<state_t>({3}));
+}
+
+TEST(TinyStateMachineExporter, ExportsGraphWithHeatmap) {
+    TinyStateMachine tsm = TinyStateMachine();
+    TinyStateMachine child = TinyStateMachine();
+    unsigned long clock = 0;
+    int counter = 0;
+
+    state_t counting = tsm.add_state_loop([&clock, &counter] {
+        clock += 10;
+        counter++;
+    });
+    state_t done = tsm.add_state();
+    tsm.add_transition(counting, done, [&counter] { return counter >= 3; });
+    tsm.add_transition(TinyStateMachine::ANY_STATE, done, [] { return false; });
+    child.add_state();
+    tsm.add_child_state_machine(done, &child);
+    tsm.enable_profiling([&clock] { return clock; });
+
+    tsm.startup();
+    for (int i = 0; i < 4; i++) tsm.loop();
+
+    EXPECT_EQ(tsm.get_state_loops(counting), 3u);
+    EXPECT_EQ(tsm.get_state_time(counting), 30u);
+    EXPECT_EQ(tsm.get_guard_evaluations(0), 3u);
+    EXPECT_EQ(tsm.get_guard_passes(0), 1u);
+    // the ANY_STATE guard is checked in every loop where no earlier guard passed.
+    EXPECT_EQ(tsm.get_guard_evaluations(1), 3u);
+    EXPECT_EQ(tsm.get_guard_passes(1), 0u);
+
+    TinyStateMachineExporter exporter = TinyStateMachineExporter(&tsm);
+    exporter.set_state_name(counting, "counting");
+    exporter.set_state_name(&child, 0, "child \"idle\"");
+    exporter.set_state_name(done, "done\tat\r\x01");
+
+    std::ostringstream dot;
+    exporter.write_dot(dot);
+    EXPECT_NE(dot.str().find("s0 [peripheries=2, fillcolor=\"0.000 1.000 1.000\", "
+                             "label=\"counting\\n3 loops, 30 time\"];"), std::string::npos);
+    EXPECT_NE(dot.str().find("subgraph cluster_s1 {"), std::string::npos);
+    EXPECT_NE(dot.str().find("label=\"done\\tat\\r\\u0001\";"), std::string::npos);
+    EXPECT_NE(dot.str().find("s1_0 [peripheries=2, label=\"child \\\"idle\\\"\"];"), std::string::npos);
+    EXPECT_NE(dot.str().find("s0 -> s1 [penwidth=5.00, label=\"1/3\"];"), std::string::npos);
+    EXPECT_NE(dot.str().find("sany0 -> s1 [style=dashed, color=red, penwidth=5.00, label=\"0/3\"];"),
+              std::string::npos);
+
+    std::ostringstream json;
+    exporter.write_json(json);
+    EXPECT_EQ(json.str(), "{\n"
+                          "  \"regions\": 1,\n"
+                          "  \"states\": [\n"
+                          "    {\"id\": 0, \"name\": \"counting\", \"region\": 0, \"start\": true, "
+                          "\"loops\": 3, \"time\": 30},\n"
+                          "    {\"id\": 1, \"name\": \"done\\tat\\r\\u0001\", \"region\": 0, \"start\": false, "
+                          "\"loops\": 1, \"time\": 0, "
+                          "\"child\": {\n"
+                          "      \"regions\": 1,\n"
+                          "      \"states\": [\n"
+                          "        {\"id\": 0, \"name\": \"child \\\"idle\\\"\", \"region\": 0, \"start\": true}\n"
+                          "      ],\n"
+                          "      \"transitions\": []\n"
+                          "    }}\n"
+                          "  ],\n"
+                          "  \"transitions\": [\n"
+                          "    {\"id\": 0, \"from\": 0, \"to\": 1, \"evaluations\": 3, \"passes\": 1},\n"
+                          "    {\"id\": 1, \"from\": \"any\", \"to\": 1, \"evaluations\": 3, \"passes\": 0}\n"
+                          "  ]\n"
+                          "}\n");
+}
+#endif